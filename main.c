@@ -3,568 +3,4279 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/drivers/uart.h>
 #include <zephyr/sys/printk.h>
+#include <zephyr/sys/printk-hooks.h>
 #include <zephyr/sys/atomic.h>
 #include <zephyr/sys_clock.h>
+#include <zephyr/timing/timing.h>
+#include <zephyr/sys/crc.h>
+#include <zephyr/fs/nvs.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/drivers/flash.h>
+#include <zephyr/ipc/ipc_service.h>
+#include <zephyr/pm/device.h>
+#include <zephyr/drivers/watchdog.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/logging/log_ctrl.h>
+#include <zephyr/logging/log_backend.h>
+#include <zephyr/logging/log_backend_std.h>
+#include <zephyr/logging/log_output.h>
 #include <stdlib.h>
 #include <string.h>
-#include <assert.h>
 
-// LED-pinien määritykset
-static const struct gpio_dt_spec red_led = GPIO_DT_SPEC_GET(DT_ALIAS(led0), gpios);    // Punainen
-static const struct gpio_dt_spec green_led = GPIO_DT_SPEC_GET(DT_ALIAS(led1), gpios);  // Vihreä
+// Lokitus on viivästettyä (CONFIG_LOG_MODE_DEFERRED): viesti kirjataan
+// puskuriin ja tulostetaan lokisäikeessä, joten valojen ajoitus ei riipu
+// konsolin nopeudesta. Taso käännetään DBG:ksi ja rajataan ajon aikana.
+LOG_MODULE_REGISTER(traffic_signals, LOG_LEVEL_DBG);
+
+// LED-pinien määritykset devicetreen aliaksista led0..ledN. Puuttuva alias
+// jättää taulukkoon tyhjän paikan, joten indeksi on aina aliaksen numero.
+#define SIGNAL_GROUPS CONFIG_TRAFFIC_SIGNALS_GROUPS  // Opastinryhmät, osoitetaan etuliitteellä '@n:'
+#define SIGNAL_GROUP_LEDS 4    // LED-aliaksia ryhmää kohden (punainen, vihreä, nuoli, jalankulkija)
+#define MAX_SIGNAL_LEDS 32     // Montako led-aliasta haetaan, LISTIFY vaatii luvun
+#define MAX_LED_PORTS 2        // nRF5340:n GPIO-portit P0 ja P1
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+#define SIGNAL_LED_SPEC(i, _) GPIO_DT_SPEC_GET_OR(DT_ALIAS(led##i), gpios, {0})
+static const struct gpio_dt_spec signal_leds[] = {
+    LISTIFY(MAX_SIGNAL_LEDS, SIGNAL_LED_SPEC, (,))
+};
+BUILD_ASSERT(SIGNAL_GROUPS * SIGNAL_GROUP_LEDS <= MAX_SIGNAL_LEDS, "Not enough LED aliases for all groups");
+#endif
+
+// Ilmaisintulot (silmukkailmaisimet) aliaksista detector1..detectorN. Askel
+// 'G,5000/20000@1' jatkuu tulon 1 havainnoista enintään 20000 ms:iin.
+#define DETECTOR_INPUTS 4
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+#define DETECTOR_SPEC(i, _) GPIO_DT_SPEC_GET_OR(DT_ALIAS(UTIL_CAT(detector, UTIL_INC(i))), gpios, {0})
+static const struct gpio_dt_spec signal_detectors[] = {
+    LISTIFY(DETECTOR_INPUTS, DETECTOR_SPEC, (,))
+};
+static uint32_t signal_detectors_present;  // Bitti n-1 = tulo n käytössä
+#endif
 
 // UART-initialisointi
 #define UART_DEVICE_NODE DT_CHOSEN(zephyr_shell_uart)
 static const struct device *const uart_dev = DEVICE_DT_GET(UART_DEVICE_NODE);
 
-#define STACK_SIZE 1024
-#define PRIORITY 5
+// Säikeiden prioriteetit ja pinot (Kconfig). Suorittaja toimii ajastimen
+// keskeytyksessä kaikkien säikeiden yläpuolella, UART-vastaanotto on sen
+// alapuolella ja jäsennin alimpana, joten pitkän sekvenssin kääntäminen ei
+// viivästytä vastaanottoa.
+#define UART_RECEIVE_PRIORITY K_PRIO_PREEMPT(CONFIG_TRAFFIC_SIGNALS_UART_PRIORITY)
+#define UART_RECEIVE_STACK_SIZE CONFIG_TRAFFIC_SIGNALS_UART_STACK_SIZE
+#define DISPATCHER_PRIORITY K_PRIO_PREEMPT(CONFIG_TRAFFIC_SIGNALS_DISPATCHER_PRIORITY)
+#define DISPATCHER_STACK_SIZE CONFIG_TRAFFIC_SIGNALS_DISPATCHER_STACK_SIZE
 #define MAX_MSG_LEN 256  // Suurensin pituutta varmuuden vuoksi
+#define UART_LINE_QUEUE_LEN 4  // Montako valmista riviä keskeytys voi jonottaa
+// Jonojen ja aikataulujen kapasiteetit (Kconfig). Kaikki muisti on
+// staattista, joten koko budjetti näkyy käännöksessä ja M,?-tulosteessa.
+#define LINE_QUEUE_SIZE CONFIG_TRAFFIC_SIGNALS_LINE_QUEUE_SIZE  // Tavuina, oltava kahden potenssi
+#define SCHEDULE_SLOTS CONFIG_TRAFFIC_SIGNALS_SCHEDULE_SLOTS    // Aktiivinen ja valmiustilassa odottavat
+#define UART_TX_RING_SIZE CONFIG_TRAFFIC_SIGNALS_UART_TX_RING_SIZE  // Tavuina, oltava kahden potenssi
+#define UART_TX_WORKQ_WAIT_MS 20  // Järjestelmän työjono odottaa täyttä lähetyspuskuria enintään näin kauan
+#define MAX_PROGRAM_STEPS CONFIG_TRAFFIC_SIGNALS_MAX_STEPS      // Askelia ohjelmaa kohden
+#define MAX_REPEAT_TIMES CONFIG_TRAFFIC_SIGNALS_MAX_REPEAT  // Suurin sallittu toistomäärä 'T'-komennolla
+#define MAX_OVERRIDE_MS 3600000  // Ajastetun ohituksen '!C,ms' enimmäiskesto
+#define DEFAULT_LOG_LEVEL LOG_LEVEL_INF  // Ajonaikainen lokitaso käynnistyksessä
+#define SCHEDULE_NVS_ID 1      // Ryhmän 1 viimeksi käynnistetyn aikataulun NVS-tunniste, ryhmä n: ID + n - 1
+#define SCHEDULE_NVS_SECTORS 3 // NVS-sektoreita storage_partitionista
+#define SCHEDULE_RECORD_VERSION 3
+#define METRICS_BUCKETS 28     // Histogrammin log2-ämpärit mikrosekunneille (~134 s asti)
+#define FAULT_FLASH_MS 500     // Vikatilan vilkku: puoli jaksoa päällä, puoli pimeänä
+#define FAULT_MONITOR_PERIOD_MS 500  // Valvonnan ja vahtikoiran ruokinnan väli
+#define FAULT_STALL_MS 250     // Näin paljon myöhässä oleva askelraja on jumi
+
+// Binäärikehys: SYNC, LEN, LEN tavua hyötykuormaa, CRC16 (CCITT, big-endian LEN:stä
+// hyötykuorman loppuun). Hyötykuorman ensimmäinen tavu on liputavu, sen jälkeen
+// askeleet: opkoodi (värikirjain tai 'T') ja kesto/toistomäärä varint-koodattuna.
+#define FRAME_SYNC 0xA5        // Ei esiinny ASCII-riveillä, joten kehys tunnistetaan rivin alusta
+#define FRAME_FLAG_MORE 0x01   // Ohjelma jatkuu seuraavassa kehyksessä
+#define FRAME_FLAG_GROUP_SHIFT 4  // Liputavun ylin nelikko: opastinryhmä - 1
+#define FRAME_CRC_LEN 2
+#define MAX_FRAME_PAYLOAD (MAX_MSG_LEN - 1 - FRAME_CRC_LEN)
+#define FRAME_ACK 0x06         // Kehys hyväksytty
+#define FRAME_NAK 0x15         // Kehys hylätty
+#define FRAME_BYTE_TIMEOUT_MS 20  // Kehyksen tavujen suurin väli, pidempi tauko hylkää kehyksen
+
+// Määrittele säikeiden pinot ja ohjauslohkot
+K_THREAD_STACK_DEFINE(uart_receive_stack, UART_RECEIVE_STACK_SIZE);
+K_THREAD_STACK_DEFINE(dispatcher_stack, DISPATCHER_STACK_SIZE);
+
+struct k_thread uart_receive_thread_data;
+struct k_thread dispatcher_thread_data;
+
+// Käännetty askel: värikoodi ja kesto millisekunteina
+struct sequence_step {
+    uint8_t color;
+    uint32_t duration;      // Kiinteä kesto tai ilmaisinaskeleen minimi (ms)
+    uint32_t max_duration;  // Enimmäiskesto ilmaisimen jatkamana, muuten = duration
+    uint8_t detector;       // Jatkava ilmaisintulo 1..DETECTOR_INPUTS tai 0
+} __packed;
+
+// Slotin omistaja. Siirtymät tehdään executor_lockin sisällä.
+enum slot_state {
+    SLOT_FREE,     // Vapaa
+    SLOT_LOADING,  // Dispatcher kääntää, suorittaja ei näe
+    SLOT_STANDBY,  // Valmiustilassa, suorittaja ottaa seuraavaksi
+    SLOT_ACTIVE,   // Suorituksessa
+};
+
+// Ohjelman tila: dispatcher kirjoittaa, suorittaja lukee
+enum program_state {
+    PROGRAM_OPEN,     // Kääntäminen kesken, askeleita voi vielä tulla
+    PROGRAM_CLOSED,   // Kaikki askeleet ja toistomäärä ovat valmiina
+    PROGRAM_ABORTED,  // Jäsennysvirhe, suoritus lopetetaan seuraavalla askelrajalla
+};
+
+// Käännetty sekvenssi. Viesti jäsennetään kerran askeltaulukoksi ja
+// toisto hoidetaan suorituksessa laskurilla, joten muistinkulutus ei
+// riipu toistomäärästä. Askeleet julkaistaan suorittajalle sitä mukaa
+// kun ne valmistuvat (ready_steps), joten suoritus voi alkaa ennen kuin
+// koko rivi on käännetty.
+struct signal_group;
+
+struct sequence_program {
+    struct signal_group *group;  // Ryhmä, jonka slotti tämä on
+    uint8_t slot_state;     // enum slot_state
+    uint32_t upload_seq;    // Valmiustilaan siirron järjestysnumero
+    uint16_t step_count;    // Käännetyt askeleet, vain dispatcher käyttää
+    uint32_t dispatch_cycles;  // Milloin ohjelma annettiin suorittajalle
+    uint16_t repeat_times;  // Voimassa, kun tila on PROGRAM_CLOSED
+    uint32_t cycle_ms;      // Koordinoidun kierron pituus tai 0, voimassa kuten repeat_times
+    uint32_t offset_ms;     // Kierron alun siirto yhteisessä aikakannassa
+    uint64_t max_total_ms;  // Askelten enimmäiskestojen summa, vain dispatcher käyttää
+    bool queued;            // Onko ohjelma jo annettu suorittajalle
+    uint8_t error;          // enum seq_parse_error, asetetaan ennen PROGRAM_ABORTED-tilaa
+    atomic_t ready_steps;   // Suorittajalle julkaistut askeleet
+    atomic_t state;         // enum program_state
+    struct sequence_step steps[MAX_PROGRAM_STEPS];
+};
+
+BUILD_ASSERT(SCHEDULE_SLOTS >= 2, "Need an active and a standby slot");
+
+// Lukoton rivijono uart_receive_taskilta (ainoa kirjoittaja) dispatcherille (ainoa lukija).
+// Jokainen tietue on otsake (pituus ja aikaleima), jota seuraavat rivin merkit.
+struct line_queue {
+    uint8_t buffer[LINE_QUEUE_SIZE];
+    atomic_t head;            // Kirjoituskohta, vain tuottaja päivittää
+    atomic_t tail;            // Lukukohta, vain kuluttaja päivittää
+    atomic_t overflow_count;  // Tilan puutteen vuoksi hylätyt rivit
+    struct k_sem data_sem;    // Jonossa olevien tietueiden määrä, herättää kuluttajan
+};
+
+BUILD_ASSERT((LINE_QUEUE_SIZE & (LINE_QUEUE_SIZE - 1)) == 0, "LINE_QUEUE_SIZE must be a power of two");
+
+// Rivin tyyppi: ASCII-rivi tai binäärikehyksen hyötykuorma
+enum line_type {
+    LINE_TEXT,
+    LINE_FRAME,
+    LINE_OVERLONG,  // Puskuria pidempi rivi hylättiin, tietueessa ei ole dataa
+};
+
+// Tietueen otsake: pituus, tyyppi ja hetki, jolloin rivi oli vastaanotettu kokonaan
+struct line_record_header {
+    uint16_t len;
+    uint8_t type;  // enum line_type
+    uint32_t received_cycles;
+} __packed;
+
+#define LINE_RECORD_HEADER_LEN sizeof(struct line_record_header)
+
+struct line_queue uart_line_queue;
+
+// Vastaanotettu rivi tai kehys ja sen ensimmäisen ja viimeisen tavun aikaleimat.
+// Kehyksestä talletetaan LEN, hyötykuorma ja CRC ilman SYNC-tavua.
+struct uart_line {
+    uint32_t start_cycles;
+    uint32_t end_cycles;
+    uint16_t len;
+    uint8_t type;  // enum line_type
+    char data[MAX_MSG_LEN];
+};
+
+// Vastaanoton tila: tekstirivi tai binäärikehyksen osat
+enum uart_rx_state {
+    UART_RX_TEXT,
+    UART_RX_FRAME_LEN,
+    UART_RX_FRAME_BODY,
+};
+
+// Keskeytys kokoaa rivin tähän ja siirtää valmiin rivin jonoon
+static struct uart_line uart_rx_line;
+static int uart_msg_index = 0;
+static enum uart_rx_state uart_rx_state = UART_RX_TEXT;
+static int uart_frame_remaining;
+static uint32_t uart_frame_byte_cycles;  // Kehyksen edellisen tavun vastaanottohetki
+static bool uart_rx_discard;  // Liian pitkä rivi: merkit hylätään rivin loppuun asti
+static atomic_t uart_rx_bad_frames = ATOMIC_INIT(0);  // Pituuden tai tauon vuoksi hylätyt kehykset
+K_MSGQ_DEFINE(uart_line_msgq, sizeof(struct uart_line), UART_LINE_QUEUE_LEN, 4);
+static atomic_t uart_rx_dropped_lines = ATOMIC_INIT(0);
+static atomic_t uart_rx_dropped_frames = ATOMIC_INIT(0);  // Täyden UART-jonon vuoksi hylätyt kehykset
+
+// Aikamuuttujat
+static uint32_t dispatcher_processing_time_us = 0;
+
+// Viivehistogrammi: ämpäri n sisältää arvot välillä [2^(n-1), 2^n) us
+struct latency_histogram {
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t buckets[METRICS_BUCKETS];
+};
+
+// Suorituskykymittarit, kysytään komennolla 'S,?' ja nollataan 'S,0'
+struct metrics {
+    struct latency_histogram line_to_dispatch;  // Rivi vastaanotettu -> dispatcher aloittaa
+    struct latency_histogram dispatch_to_edge;  // Ohjelma suorittajalle -> ensimmäinen GPIO-vaihto
+    struct latency_histogram dwell_error;       // |toteutunut - pyydetty| askeleen kesto
+    uint32_t uart_lines_hwm;                    // UART-rivijonon suurin täyttö
+    uint32_t line_queue_hwm;                    // Rivijonon suurin täyttö tavuina
+    uint32_t programs_hwm;                      // Jonossa/suorituksessa olleet ohjelmat enimmillään
+    uint32_t program_allocs;                    // Aikatauluille varatut slotit
+    uint32_t uart_rx_dropped;                   // Täyden UART-jonon vuoksi hylätyt rivit
+    uint32_t uart_rx_overlong;                  // Puskuria pidempinä hylätyt rivit
+    uint32_t uart_tx_dropped;                   // Täyden lähetyspuskurin vuoksi hylätyt tavut
+    uint32_t frames_accepted;                   // Hyväksytyt binäärikehykset
+    uint32_t frames_rejected;                   // Pituus-, CRC- tai sisältövirheen vuoksi hylätyt
+    uint32_t timer_wakes;                       // Suorittajan ajastinkeskeytykset
+    uint32_t uart_rx_wakes;                     // UART RX -keskeytykset
+    uint32_t uart_resumes;                      // UARTin herätykset lepotilasta
+    uint32_t events_dropped;                    // Täyden tapahtumajonon vuoksi hylätyt
+};
+
+static struct metrics metrics;
+static struct k_spinlock metrics_lock;
+
+#ifdef CONFIG_SCHED_THREAD_USAGE_ALL
+// Suoritinajan lähtötaso S,0-nollauksen hetkellä, joutoajan osuutta varten
+static k_thread_runtime_stats_t power_baseline;
+#endif
+
+// SWAP-pyyntö ryhmän suorittajalle
+enum swap_request {
+    SWAP_NONE,
+    SWAP_STEP,   // Vaihdetaan seuraavalla askelrajalla
+    SWAP_CYCLE,  // Vaihdetaan, kun aktiivisen aikataulun kierros päättyy
+};
+
+// Ohituskomennon toiminto
+enum override_action {
+    OVERRIDE_START,    // !C[,ms]: askel katkaistaan ja näytetään väri C
+    OVERRIDE_RESUME,   // !>: palataan katkaistuun askeleeseen
+    OVERRIDE_DISCARD,  // !X: hylätään ryhmän aikataulut
+};
+
+static void histogram_reset(struct latency_histogram *h) {
+    memset(h, 0, sizeof(*h));
+    h->min = UINT32_MAX;
+}
+
+// Kirjataan arvo histogrammiin; turvallinen myös keskeytyksestä
+static void metrics_record(struct latency_histogram *h, uint32_t value_us) {
+    int bucket = (value_us == 0) ? 0 : 32 - __builtin_clz(value_us);
+    k_spinlock_key_t key = k_spin_lock(&metrics_lock);
+
+    h->count++;
+    h->sum += value_us;
+    h->min = MIN(h->min, value_us);
+    h->max = MAX(h->max, value_us);
+    h->buckets[MIN(bucket, METRICS_BUCKETS - 1)]++;
+
+    k_spin_unlock(&metrics_lock, key);
+}
+
+// Kasvatetaan laskuria; turvallinen myös keskeytyksestä
+static void metrics_count(uint32_t *counter, uint32_t n) {
+    k_spinlock_key_t key = k_spin_lock(&metrics_lock);
+    *counter += n;
+    k_spin_unlock(&metrics_lock, key);
+}
+
+// Päivitetään jonon täytön huippuarvo
+static void metrics_hwm(uint32_t *hwm, uint32_t value) {
+    k_spinlock_key_t key = k_spin_lock(&metrics_lock);
+    *hwm = MAX(*hwm, value);
+    k_spin_unlock(&metrics_lock, key);
+}
+
+// 99. persentiilin yläraja: sen ämpärin yläreuna, johon 99 % arvoista mahtuu
+static uint32_t histogram_p99(const struct latency_histogram *h) {
+    uint32_t target = h->count - h->count / 100;
+    uint32_t cumulative = 0;
+
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+        cumulative += h->buckets[i];
+        if (cumulative >= target) {
+            uint32_t upper = (i == 0) ? 0 : (i >= 32 ? UINT32_MAX : (uint32_t)((1ULL << i) - 1));
+            return MIN(upper, h->max);
+        }
+    }
+    return h->max;
+}
+
+static void histogram_print(const char *name, const struct latency_histogram *h) {
+    if (h->count == 0) {
+        printk("%s: n=0\n", name);
+        return;
+    }
+    printk("%s: n=%u min=%u max=%u avg=%u p99<=%u us\n", name, h->count, h->min, h->max,
+           (uint32_t)(h->sum / h->count), histogram_p99(h));
+}
+
+void metrics_reset(void) {
+    k_spinlock_key_t key = k_spin_lock(&metrics_lock);
+    histogram_reset(&metrics.line_to_dispatch);
+    histogram_reset(&metrics.dispatch_to_edge);
+    histogram_reset(&metrics.dwell_error);
+    metrics.uart_lines_hwm = 0;
+    metrics.line_queue_hwm = 0;
+    metrics.programs_hwm = 0;
+    metrics.program_allocs = 0;
+    metrics.uart_rx_dropped = 0;
+    metrics.uart_rx_overlong = 0;
+    metrics.uart_tx_dropped = 0;
+    metrics.frames_accepted = 0;
+    metrics.frames_rejected = 0;
+    metrics.timer_wakes = 0;
+    metrics.uart_rx_wakes = 0;
+    metrics.uart_resumes = 0;
+    metrics.events_dropped = 0;
+    k_spin_unlock(&metrics_lock, key);
+#ifdef CONFIG_SCHED_THREAD_USAGE_ALL
+    k_thread_runtime_stats_all_get(&power_baseline);
+#endif
+}
+
+void metrics_print(void) {
+    struct metrics snapshot;
+    k_spinlock_key_t key = k_spin_lock(&metrics_lock);
+    snapshot = metrics;
+    k_spin_unlock(&metrics_lock, key);
+
+    histogram_print("line_to_dispatch", &snapshot.line_to_dispatch);
+    histogram_print("dispatch_to_edge", &snapshot.dispatch_to_edge);
+    histogram_print("dwell_error", &snapshot.dwell_error);
+    printk("hwm: uart_lines=%u/%u line_queue=%u/%u programs=%u/%u\n",
+           snapshot.uart_lines_hwm, UART_LINE_QUEUE_LEN,
+           snapshot.line_queue_hwm, LINE_QUEUE_SIZE,
+           snapshot.programs_hwm, SCHEDULE_SLOTS);
+    printk("drops: uart_rx=%u overlong=%u uart_tx=%u line_queue=%ld events=%u\n", snapshot.uart_rx_dropped,
+           snapshot.uart_rx_overlong, snapshot.uart_tx_dropped, (long)atomic_get(&uart_line_queue.overflow_count), snapshot.events_dropped);
+    printk("frames: accepted=%u rejected=%u\n", snapshot.frames_accepted, snapshot.frames_rejected);
+    printk("allocs: slots=%u\n", snapshot.program_allocs);
+
+    // Herätykset ja joutoajan osuus. Virrankulutus mitataan ulkoisesti;
+    // se seuraa suoraan herätysten määrää ja joutoajan osuutta.
+    printk("wakes: timer=%u uart_rx=%u uart_resume=%u\n", snapshot.timer_wakes, snapshot.uart_rx_wakes,
+           snapshot.uart_resumes);
+#ifdef CONFIG_SCHED_THREAD_USAGE_ALL
+    k_thread_runtime_stats_t now;
+    k_thread_runtime_stats_all_get(&now);
+    uint64_t all_cycles = now.execution_cycles - power_baseline.execution_cycles;
+    uint64_t idle_cycles = now.idle_cycles - power_baseline.idle_cycles;
+    uint32_t idle_permille = (all_cycles > 0) ? (uint32_t)(idle_cycles * 1000 / all_cycles) : 0;
+    printk("idle: %u.%u%%\n", idle_permille / 10, idle_permille % 10);
+#endif
+}
+
+// Tapahtumakanava: suorittaja ja dispatcher kirjaavat sekvenssien
+// etenemisen jonoon odottamatta, ja järjestelmän työjono välittää
+// tapahtumat kuuntelijoille. Kumpikaan ei siis odota kuuntelijoita, eikä
+// dispatcher odota sekvenssin suoritusta. Täysi jono hylkää tapahtuman.
+#define SIGNAL_EVENT_QUEUE_LEN 16
+#define SIGNAL_EVENT_LISTENERS 4
+
+enum signal_event_type {
+    SIGNAL_EVENT_STARTED,    // Ohjelma käynnistyi
+    SIGNAL_EVENT_STEP_DONE,  // Askel päättyi: step ja value (toteutunut kesto us)
+    SIGNAL_EVENT_DONE,       // Ohjelma päättyi tai vaihdettiin: value (kesto us)
+    SIGNAL_EVENT_ERROR,      // Ohjelma hylättiin tai keskeytettiin: value (enum seq_parse_error, 0 = keskeytys)
+    SIGNAL_EVENT_FAULT,      // Vikatila alkoi: value (enum fault_cause)
+};
+
+static const char *const signal_event_names[] = {
+    [SIGNAL_EVENT_STARTED] = "START",
+    [SIGNAL_EVENT_STEP_DONE] = "STEP",
+    [SIGNAL_EVENT_DONE] = "DONE",
+    [SIGNAL_EVENT_ERROR] = "ERROR",
+    [SIGNAL_EVENT_FAULT] = "FAULT",
+};
+
+struct signal_event {
+    uint8_t type;      // enum signal_event_type
+    uint8_t group_id;
+    uint16_t step;
+    uint32_t seq;      // Ohjelman upload_seq, 0 jos ohjelmaa ei jonotettu
+    uint32_t value;
+};
+
+typedef void (*signal_event_listener_t)(const struct signal_event *event);
+
+K_MSGQ_DEFINE(signal_event_msgq, sizeof(struct signal_event), SIGNAL_EVENT_QUEUE_LEN, 4);
+static signal_event_listener_t signal_event_listeners[SIGNAL_EVENT_LISTENERS];
+
+static void signal_event_handler(struct k_work *work) {
+    ARG_UNUSED(work);
+    struct signal_event event;
+
+    while (k_msgq_get(&signal_event_msgq, &event, K_NO_WAIT) == 0) {
+        for (int i = 0; i < SIGNAL_EVENT_LISTENERS; i++) {
+            if (signal_event_listeners[i] != NULL) {
+                signal_event_listeners[i](&event);
+            }
+        }
+    }
+}
+
+static K_WORK_DEFINE(signal_event_work, signal_event_handler);
+
+// Kirjataan tapahtuma. Ei odota, joten kutsuttavissa myös keskeytyksestä.
+static void signal_event_post(enum signal_event_type type, uint8_t group_id, uint32_t seq, uint16_t step,
+                              uint32_t value) {
+    struct signal_event event = {
+        .type = type,
+        .group_id = group_id,
+        .step = step,
+        .seq = seq,
+        .value = value,
+    };
+
+    if (k_msgq_put(&signal_event_msgq, &event, K_NO_WAIT) != 0) {
+        metrics_count(&metrics.events_dropped, 1);
+        return;
+    }
+    k_work_submit(&signal_event_work);
+}
+
+// Rekisteröidään kuuntelija ennen säikeiden käynnistystä. Kuuntelijaa
+// kutsutaan järjestelmän työjonosta.
+static int signal_event_listen(signal_event_listener_t listener) {
+    for (int i = 0; i < SIGNAL_EVENT_LISTENERS; i++) {
+        if (signal_event_listeners[i] == NULL) {
+            signal_event_listeners[i] = listener;
+            return 0;
+        }
+    }
+    return -ENOMEM;
+}
+
+// Sarjaportin kuuntelija, kytketään komennolla N,1:
+// EV,<tyyppi>,<ryhmä>,<ohjelma>,<askel>,<arvo>
+static atomic_t signal_events_serial;
+
+static void signal_event_print(const struct signal_event *event) {
+    if (atomic_get(&signal_events_serial)) {
+        printk("EV,%s,%u,%u,%u,%u\n", signal_event_names[event->type], event->group_id, event->seq, event->step,
+               event->value);
+    }
+}
+
+// UART-lähetys: kaikki tuloste (printk, kaiutus, kuittaukset) kirjoitetaan
+// rengaspuskuriin, jonka UART-keskeytys tyhjentää FIFOon. Kirjoittajia on
+// useita, joten rengasta käsitellään spinlockin alla. Vastaanottosäie ei
+// koskaan odota lähetystä merkki kerrallaan.
+BUILD_ASSERT((UART_TX_RING_SIZE & (UART_TX_RING_SIZE - 1)) == 0, "UART TX ring size must be a power of two");
+// LOG_PRINTK ohjaisi printk:n lokin kautta ohi renkaan ja koukun
+BUILD_ASSERT(!IS_ENABLED(CONFIG_LOG_PRINTK), "Replies go through the printk hook, set CONFIG_LOG_PRINTK=n");
+static uint8_t uart_tx_ring[UART_TX_RING_SIZE];
+static uint32_t uart_tx_head;  // Kirjoitettu
+static uint32_t uart_tx_tail;  // Annettu UARTille
+static struct k_spinlock uart_tx_lock;
+static bool uart_tx_irq;       // Keskeytys asennettu, muuten lähetetään pollaten
+#ifdef CONFIG_TRAFFIC_SIGNALS_UART_IDLE_SUSPEND
+static bool uart_suspended;    // UART lepotilassa, lähetys herättää sen
+#endif
+static K_SEM_DEFINE(uart_tx_space_sem, 0, 1);
+
+// Kaiutus: pois, kuittaus (ACK/NAK) riviä kohden tai koko rivi takaisin
+enum echo_mode {
+    ECHO_OFF,
+    ECHO_ACK,
+    ECHO_FULL,
+};
+
+static atomic_t uart_echo_mode = ATOMIC_INIT(CONFIG_TRAFFIC_SIGNALS_ECHO_MODE);
+
+// UART-keskeytyspalvelu: luetaan merkit suoraan rivipuskuriin
+#ifdef CONFIG_TRAFFIC_SIGNALS_UART_IDLE_SUSPEND
+// Virransäästö: kun sarjalinja on ollut hiljaa CONFIG_TRAFFIC_SIGNALS_UART_IDLE_TIMEOUT_MS,
+// UART pysäytetään (UARTE pitää muuten suurtaajuuskellon käynnissä) ja
+// RX-linjan aloitusbitti herättää sen GPIO-keskeytyksellä. Herättävä merkki
+// menee hukkaan, joten lähettäjä aloittaa rivinvaihdolla (tyhjät rivit ohitetaan).
+// Pinni annetaan devicetreessä: zephyr,user { uart-wake-gpios = <...>; }.
+static const struct gpio_dt_spec uart_wake_gpio = GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), uart_wake_gpios);
+static struct gpio_callback uart_wake_cb;
+
+static void uart_idle_handler(struct k_work *work);
+static void uart_resume_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(uart_idle_work, uart_idle_handler);
+static K_WORK_DEFINE(uart_resume_work, uart_resume_handler);
+
+// Linja hiljeni: UART lepoon ja RX-linjan herätys päälle
+static void uart_idle_handler(struct k_work *work) {
+    ARG_UNUSED(work);
+
+    // Lähetettävää vielä puskurissa: odotetaan seuraava jakso
+    k_spinlock_key_t key = k_spin_lock(&uart_tx_lock);
+    if (uart_tx_head != uart_tx_tail) {
+        k_spin_unlock(&uart_tx_lock, key);
+        k_work_reschedule(&uart_idle_work, K_MSEC(CONFIG_TRAFFIC_SIGNALS_UART_IDLE_TIMEOUT_MS));
+        return;
+    }
+    uart_suspended = true;
+    k_spin_unlock(&uart_tx_lock, key);
+
+    uart_irq_rx_disable(uart_dev);
+    int ret = pm_device_action_run(uart_dev, PM_DEVICE_ACTION_SUSPEND);
+    if (ret != 0) {
+        uart_suspended = false;
+        uart_irq_rx_enable(uart_dev);
+        return;
+    }
+    gpio_pin_configure_dt(&uart_wake_gpio, GPIO_INPUT);
+    gpio_pin_interrupt_configure_dt(&uart_wake_gpio, GPIO_INT_EDGE_TO_ACTIVE);
+}
+
+// RX-linjalla liikettä tai lähetettävää: UART takaisin käyttöön
+static void uart_resume_handler(struct k_work *work) {
+    ARG_UNUSED(work);
+
+    if (!uart_suspended) {
+        return;
+    }
+    gpio_pin_interrupt_configure_dt(&uart_wake_gpio, GPIO_INT_DISABLE);
+    pm_device_action_run(uart_dev, PM_DEVICE_ACTION_RESUME);
+    uart_irq_rx_enable(uart_dev);
+
+    k_spinlock_key_t key = k_spin_lock(&uart_tx_lock);
+    uart_suspended = false;
+    if (uart_tx_head != uart_tx_tail) {
+        uart_irq_tx_enable(uart_dev);
+    }
+    k_spin_unlock(&uart_tx_lock, key);
+    metrics_count(&metrics.uart_resumes, 1);
+    k_work_reschedule(&uart_idle_work, K_MSEC(CONFIG_TRAFFIC_SIGNALS_UART_IDLE_TIMEOUT_MS));
+}
+
+static void uart_wake_isr(const struct device *port, struct gpio_callback *cb, gpio_port_pins_t pins) {
+    gpio_pin_interrupt_configure_dt(&uart_wake_gpio, GPIO_INT_DISABLE);
+    k_work_submit(&uart_resume_work);
+}
+
+static int uart_idle_init(void) {
+    if (!gpio_is_ready_dt(&uart_wake_gpio)) {
+        return -ENODEV;
+    }
+    gpio_init_callback(&uart_wake_cb, uart_wake_isr, BIT(uart_wake_gpio.pin));
+    int ret = gpio_add_callback_dt(&uart_wake_gpio, &uart_wake_cb);
+    if (ret != 0) {
+        return ret;
+    }
+    k_work_reschedule(&uart_idle_work, K_MSEC(CONFIG_TRAFFIC_SIGNALS_UART_IDLE_TIMEOUT_MS));
+    return 0;
+}
+#endif /* CONFIG_TRAFFIC_SIGNALS_UART_IDLE_SUSPEND */
+
+// Kopioidaan renkaaseen mahtuva osa ja käynnistetään lähetyskeskeytys.
+// whole: kopioidaan kaikki tai ei mitään, jolloin muu tuloste ei osu väliin.
+static size_t uart_tx_put(const uint8_t *data, size_t len, bool whole) {
+    k_spinlock_key_t key = k_spin_lock(&uart_tx_lock);
+    size_t n = MIN(len, UART_TX_RING_SIZE - (uart_tx_head - uart_tx_tail));
+
+    if (whole && n < len) {
+        n = 0;
+    }
+    for (size_t i = 0; i < n; i++) {
+        uart_tx_ring[(uart_tx_head + i) & (UART_TX_RING_SIZE - 1)] = data[i];
+    }
+    uart_tx_head += n;
+    if (n > 0) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_UART_IDLE_SUSPEND
+        if (uart_suspended) {
+            k_work_submit(&uart_resume_work);
+        } else {
+            uart_irq_tx_enable(uart_dev);
+        }
+#else
+        uart_irq_tx_enable(uart_dev);
+#endif
+    }
+    k_spin_unlock(&uart_tx_lock, key);
+    return n;
+}
+
+// Lähetetään len tavua. Täydestä puskurista odotetaan enintään timeout,
+// mitä ei mahdu, hylätään ja lasketaan. Ennen keskeytyksen asennusta
+// (tai kun UARTia ei käytetä vastaanottoon) lähetetään pollaten.
+static void uart_tx_write(const void *data, size_t len, k_timeout_t timeout) {
+    const uint8_t *bytes = data;
+    size_t done = 0;
+
+    if (!uart_tx_irq) {
+        for (size_t i = 0; i < len; i++) {
+            uart_poll_out(uart_dev, bytes[i]);
+        }
+        return;
+    }
+
+    while (done < len) {
+        done += uart_tx_put(&bytes[done], len - done, false);
+        if (done < len && k_sem_take(&uart_tx_space_sem, timeout) != 0) {
+            metrics_count(&metrics.uart_tx_dropped, len - done);
+            return;
+        }
+    }
+}
+
+// Lähetetään lohko yhtenä kokonaisuutena: odotetaan, kunnes koko lohko
+// mahtuu renkaaseen. Lohko ei saa olla rengasta pidempi.
+static void uart_tx_write_block(const void *data, size_t len, k_timeout_t timeout) {
+    __ASSERT_NO_MSG(len <= UART_TX_RING_SIZE);
+
+    if (len == 0) {
+        return;
+    }
+    if (!uart_tx_irq) {
+        uart_tx_write(data, len, timeout);
+        return;
+    }
+    while (uart_tx_put(data, len, true) == 0) {
+        if (k_sem_take(&uart_tx_space_sem, timeout) != 0) {
+            metrics_count(&metrics.uart_tx_dropped, len);
+            return;
+        }
+    }
+}
+
+static void uart_tx_byte(uint8_t byte) {
+    uart_tx_write(&byte, 1, K_FOREVER);
+}
+
+// Kauanko printk odottaa täyttä puskuria. Keskeytyksestä ei voi odottaa.
+// Järjestelmän työjono ajaa myös UARTin herätyksen, tapahtumien
+// välityksen ja vikavalvonnan, joten se ei odota lepäävää UARTia
+// lainkaan eikä muutenkaan kauan: tuloste hylätään ja lasketaan.
+static k_timeout_t uart_tx_printk_timeout(void) {
+    if (k_is_in_isr() || k_is_pre_kernel()) {
+        return K_NO_WAIT;
+    }
+    if (k_current_get() == &k_sys_work_q.thread) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_UART_IDLE_SUSPEND
+        if (uart_suspended) {
+            return K_NO_WAIT;
+        }
+#endif
+        return K_MSEC(UART_TX_WORKQ_WAIT_MS);
+    }
+    return K_FOREVER;
+}
+
+// printk kulkee samaa reittiä
+static int uart_tx_printk_char(int c) {
+    uint8_t byte = (uint8_t)c;
+
+    uart_tx_write(&byte, 1, uart_tx_printk_timeout());
+    return c;
+}
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_UART_LOG_BACKEND
+// Lokitausta: lokiviestit kirjoitetaan samaan renkaaseen kuin vastaukset,
+// joten ne eivät ohita jonossa olevaa tulostetta eivätkä osu binäärilohkon
+// keskelle. Puskurillinen kirjoitetaan kerralla, joten lyhyt lokirivi
+// pysyy yhtenäisenä. Paniikissa rengas tyhjennetään pollaten.
+#define UART_LOG_BUF_SIZE 128
+BUILD_ASSERT(UART_LOG_BUF_SIZE <= UART_TX_RING_SIZE, "Log buffer must fit in the UART TX ring");
+BUILD_ASSERT(!IS_ENABLED(CONFIG_LOG_BACKEND_UART), "Logs go through the TX ring, set CONFIG_LOG_BACKEND_UART=n");
+
+static int uart_log_out(uint8_t *data, size_t length, void *ctx) {
+    ARG_UNUSED(ctx);
+    uart_tx_write_block(data, length, uart_tx_printk_timeout());
+    return (int)length;
+}
+
+static uint8_t uart_log_buf[UART_LOG_BUF_SIZE];
+LOG_OUTPUT_DEFINE(uart_log_output, uart_log_out, uart_log_buf, sizeof(uart_log_buf));
+
+static void uart_log_process(const struct log_backend *const backend, union log_msg_generic *msg) {
+    ARG_UNUSED(backend);
+    log_output_msg_process(&uart_log_output, &msg->log, log_backend_std_get_flags());
+}
+
+static void uart_log_dropped(const struct log_backend *const backend, uint32_t cnt) {
+    ARG_UNUSED(backend);
+    log_output_dropped_process(&uart_log_output, cnt);
+}
+
+static void uart_log_panic(const struct log_backend *const backend) {
+    ARG_UNUSED(backend);
+    k_spinlock_key_t key = k_spin_lock(&uart_tx_lock);
+
+    uart_tx_irq = false;
+    uart_irq_tx_disable(uart_dev);
+    while (uart_tx_tail != uart_tx_head) {
+        uart_poll_out(uart_dev, uart_tx_ring[uart_tx_tail++ & (UART_TX_RING_SIZE - 1)]);
+    }
+    k_spin_unlock(&uart_tx_lock, key);
+    log_output_flush(&uart_log_output);
+}
+
+static const struct log_backend_api uart_log_backend_api = {
+    .process = uart_log_process,
+    .dropped = uart_log_dropped,
+    .panic = uart_log_panic,
+};
+
+LOG_BACKEND_DEFINE(uart_log_backend, uart_log_backend_api, true);
+#endif /* CONFIG_TRAFFIC_SIGNALS_UART_LOG_BACKEND */
+
+// Täytetään FIFO renkaasta, tyhjästä renkaasta lähetyskeskeytys pois
+static void uart_tx_drain(const struct device *dev) {
+    k_spinlock_key_t key = k_spin_lock(&uart_tx_lock);
+    uint32_t pending = uart_tx_head - uart_tx_tail;
+
+    if (pending == 0) {
+        uart_irq_tx_disable(dev);
+    } else {
+        uint32_t pos = uart_tx_tail & (UART_TX_RING_SIZE - 1);
+        int sent = uart_fifo_fill(dev, &uart_tx_ring[pos], MIN(pending, UART_TX_RING_SIZE - pos));
+        if (sent > 0) {
+            uart_tx_tail += sent;
+        }
+    }
+    k_spin_unlock(&uart_tx_lock, key);
+    k_sem_give(&uart_tx_space_sem);
+}
+
+// Viedään koottu rivi jonoon (kutsutaan keskeytyksestä)
+static bool override_line(const char *line, uint32_t end_cycles, bool *accepted);
+
+static void uart_rx_line_complete(enum line_type type) {
+    uart_rx_line.len = uart_msg_index;
+    uart_rx_line.type = type;
+    if (type == LINE_TEXT) {
+        uart_rx_line.data[uart_msg_index] = '\0';
+    }
+    uart_rx_line.end_cycles = k_cycle_get_32();
+
+    // Ohituskomento ohittaa jonossa odottavat rivit eikä kulje jonon kautta.
+    // Kuittaustilassa se kuitataan heti täältä, kuten muutkin rivit.
+    bool accepted;
+    if (type == LINE_TEXT && override_line(uart_rx_line.data, uart_rx_line.end_cycles, &accepted)) {
+        if (atomic_get(&uart_echo_mode) == ECHO_ACK) {
+            uint8_t reply = accepted ? FRAME_ACK : FRAME_NAK;
+            uart_tx_write(&reply, 1, K_NO_WAIT);
+        }
+        uart_msg_index = 0;
+        return;
+    }
+    if (k_msgq_put(&uart_line_msgq, &uart_rx_line, K_NO_WAIT) != 0) {
+        // Jono täynnä, rivi tai kehys hylätään
+        atomic_inc(type == LINE_FRAME ? &uart_rx_dropped_frames : &uart_rx_dropped_lines);
+    }
+    metrics_hwm(&metrics.uart_lines_hwm, k_msgq_num_used_get(&uart_line_msgq));
+    uart_msg_index = 0;
+}
+
+static void uart_isr(const struct device *dev, void *user_data) {
+    ARG_UNUSED(user_data);
+    uint8_t c;
+
+    if (!uart_irq_update(dev)) {
+        return;
+    }
+
+    if (uart_irq_tx_ready(dev)) {
+        uart_tx_drain(dev);
+    }
+    if (!uart_irq_rx_ready(dev)) {
+        return;
+    }
+
+    metrics_count(&metrics.uart_rx_wakes, 1);
+#ifdef CONFIG_TRAFFIC_SIGNALS_UART_IDLE_SUSPEND
+    k_work_reschedule(&uart_idle_work, K_MSEC(CONFIG_TRAFFIC_SIGNALS_UART_IDLE_TIMEOUT_MS));
+#endif
+
+    while (uart_irq_rx_ready(dev) && uart_fifo_read(dev, &c, 1) == 1) {
+        // Kehyksen keskellä pitkä tauko tarkoittaa kadonnutta tavua: kesken
+        // oleva kehys hylätään, ja tavu käsitellään rivin alkuna, jolloin
+        // seuraavan kehyksen SYNC tunnistetaan
+        if (uart_rx_state != UART_RX_TEXT) {
+            uint32_t now = k_cycle_get_32();
+            if (now - uart_frame_byte_cycles > k_ms_to_cyc_ceil32(FRAME_BYTE_TIMEOUT_MS)) {
+                atomic_inc(&uart_rx_bad_frames);
+                uart_rx_state = UART_RX_TEXT;
+                uart_msg_index = 0;
+            }
+            uart_frame_byte_cycles = now;
+        }
+
+        if (uart_rx_state == UART_RX_FRAME_LEN) {
+            // Kehyksen pituus: virheellinen pituus hylkää kehyksen heti
+            if (c == 0 || c > MAX_FRAME_PAYLOAD) {
+                atomic_inc(&uart_rx_bad_frames);
+                uart_rx_state = UART_RX_TEXT;
+                continue;
+            }
+            uart_rx_line.data[0] = c;
+            uart_msg_index = 1;
+            uart_frame_remaining = c + FRAME_CRC_LEN;
+            uart_rx_state = UART_RX_FRAME_BODY;
+            continue;
+        }
+
+        if (uart_rx_state == UART_RX_FRAME_BODY) {
+            uart_rx_line.data[uart_msg_index++] = c;
+            if (--uart_frame_remaining == 0) {
+                uart_rx_line_complete(LINE_FRAME);
+                uart_rx_state = UART_RX_TEXT;
+            }
+            continue;
+        }
+
+        // Liian pitkä rivi hylätään kokonaan: sen alkua ei viedä eteenpäin
+        // eikä loppua käsitellä uutena rivinä
+        if (uart_rx_discard) {
+            if (c == '\n' || c == '\r') {
+                uart_rx_discard = false;
+                uart_msg_index = 0;
+                uart_rx_line_complete(LINE_OVERLONG);
+            }
+            continue;
+        }
+
+        // Rivin alussa oleva SYNC-tavu aloittaa binäärikehyksen
+        if (uart_msg_index == 0 && c == FRAME_SYNC) {
+            uart_rx_line.start_cycles = k_cycle_get_32();
+            uart_frame_byte_cycles = uart_rx_line.start_cycles;
+            uart_rx_state = UART_RX_FRAME_LEN;
+            continue;
+        }
+
+        // Rivin loppu (rivinvaihto '\n' tai '\r'), tyhjät rivit ohitetaan
+        if (c == '\n' || c == '\r') {
+            if (uart_msg_index > 0) {
+                uart_rx_line_complete(LINE_TEXT);
+            }
+            continue;
+        }
+
+        if (uart_msg_index == 0) {
+            uart_rx_line.start_cycles = k_cycle_get_32();
+        }
+        // Puskuri täynnä (lopetusmerkille jätetään tila): rivi hylätään
+        if (uart_msg_index >= MAX_MSG_LEN - 1) {
+            uart_rx_discard = true;
+            continue;
+        }
+        uart_rx_line.data[uart_msg_index++] = c;
+    }
+}
+
+// UART-initialisointifunktio
+int init_uart(void) {
+    if (!device_is_ready(uart_dev)) {
+        LOG_ERR("UART device not ready!");
+        return 1;
+    }
+
+    int ret = uart_irq_callback_user_data_set(uart_dev, uart_isr, NULL);
+    if (ret < 0) {
+        LOG_ERR("UART interrupt setup failed (%d)", ret);
+        return 1;
+    }
+    uart_tx_irq = true;
+    __printk_hook_install(uart_tx_printk_char);
+    uart_irq_rx_enable(uart_dev);
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_UART_IDLE_SUSPEND
+    ret = uart_idle_init();
+    if (ret != 0) {
+        LOG_WRN("UART idle suspend unavailable (%d)", ret);
+    }
+#endif
+
+    LOG_INF("UART initialized successfully");
+    return 0;
+}
+
+// Värikoodin ja LEDien vastaavuus. Bitti n on ryhmän n:s LED-alias. Keltaiselle ei
+// kehityskortilla ole omaa LEDiä, joten se näytetään punaisena ja vihreänä.
+// Väri on ryhmällä käytettävissä vain, jos kaikki sen LEDit löytyvät devicetreestä.
+struct signal_color {
+    char color;
+    const char *name;
+    uint32_t leds;
+};
+
+static const struct signal_color signal_colors[] = {
+    {'R', "Red", BIT(0)},
+    {'G', "Green", BIT(1)},
+    {'Y', "Yellow", BIT(0) | BIT(1)},
+    {'A', "Arrow", BIT(2)},
+    {'W', "Walk", BIT(3)},
+};
+
+static const struct signal_color *find_signal_color(char color) {
+    for (size_t i = 0; i < ARRAY_SIZE(signal_colors); i++) {
+        if (signal_colors[i].color == color) {
+            return &signal_colors[i];
+        }
+    }
+    return NULL;
+}
+
+// Onko ilmaisintulo 1..DETECTOR_INPUTS käytössä. Verkkoydin ei näe tuloja,
+// joten sovellusydin tarkistaa ne vastaanottaessaan aikataulun.
+static bool signal_detector_available(unsigned int input) {
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+    return input >= 1 && input <= DETECTOR_INPUTS && (signal_detectors_present & BIT(input - 1));
+#else
+    return input >= 1 && input <= DETECTOR_INPUTS;
+#endif
+}
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+
+// Vaiheen porttikirjoitukset: jokaiselle portille maski ja arvo, joten koko
+// vaihe asetetaan yhdellä gpio_port_set_masked-kutsulla porttia kohden.
+struct signal_phase {
+    uint8_t port_count;
+    struct {
+        const struct device *port;
+        gpio_port_pins_t mask;
+        gpio_port_value_t value;
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+        gpio_port_pins_t verify;  // Takaisin luettavat pinnit
+#endif
+    } ports[MAX_LED_PORTS];
+};
+
+static uint32_t signal_leds_present;  // Devicetreestä löytyneet LEDit
+
+// Vikavalvonta lukee LED-pinnit takaisin, joten niiden tulopuskuri kytketään
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+#define SIGNAL_LED_READBACK GPIO_INPUT
+
+// LEDit, joiden tulopuskuri saatiin kytkettyä. Muita ei tarkisteta.
+static uint32_t signal_leds_readback;
+#else
+#define SIGNAL_LED_READBACK 0
+#endif
+
+// Lasketaan vaihe: leds-joukon LEDit ovat maskissa, niistä on_leds sytytetään.
+// Muiden ryhmien pinnit jäävät maskin ulkopuolelle.
+static int signal_phase_build(uint32_t leds, uint32_t on_leds, struct signal_phase *phase) {
+    phase->port_count = 0;
+
+    for (size_t i = 0; i < ARRAY_SIZE(signal_leds); i++) {
+        const struct gpio_dt_spec *led = &signal_leds[i];
+        if (!(leds & BIT(i))) {
+            continue;
+        }
+
+        int p = 0;
+        while (p < phase->port_count && phase->ports[p].port != led->port) {
+            p++;
+        }
+        if (p == phase->port_count) {
+            if (p == MAX_LED_PORTS) {
+                return -ENOMEM;
+            }
+            phase->ports[p].port = led->port;
+            phase->ports[p].mask = 0;
+            phase->ports[p].value = 0;
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+            phase->ports[p].verify = 0;
+#endif
+            phase->port_count++;
+        }
+        phase->ports[p].mask |= BIT(led->pin);
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+        if (signal_leds_readback & BIT(i)) {
+            phase->ports[p].verify |= BIT(led->pin);
+        }
+#endif
+        if (on_leds & BIT(i)) {
+            phase->ports[p].value |= BIT(led->pin);
+        }
+    }
+    return 0;
+}
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_EDGE_TRACE
+// Lähtöjen vaihtojen jäljitys (X,?). Aikaleima otetaan ohjelmallisesti juuri
+// ennen porttikirjoituksia; write_cycles on kirjoitusten kesto, eli aika,
+// jonka LEDit voivat olla välitilassa. Tarkka aikaleima ja kesto luetaan
+// ajoitusfunktioiden laskurista (Cortex-M:llä DWT), koska järjestelmäkello
+// on nRF5340:llä 32768 Hz:n RTC. Laskuri pyörähtää ympäri kymmenissä
+// sekunneissa, joten mukana on myös järjestelmäkellon lukema.
+#define EDGE_TRACE_SIZE CONFIG_TRAFFIC_SIGNALS_EDGE_TRACE_SIZE
+BUILD_ASSERT((EDGE_TRACE_SIZE & (EDGE_TRACE_SIZE - 1)) == 0, "Edge trace size must be a power of two");
+
+struct edge_trace_entry {
+    uint32_t cycles;        // Ajoitusfunktioiden laskuri ennen ensimmäistä kirjoitusta
+    uint32_t clock;         // k_cycle_get_32 samalla hetkellä, pyörähdysten selvittämiseen
+    uint16_t write_cycles;  // Porttikirjoitusten kesto laskurin jaksoina, kyllästyy 0xFFFF:ään
+    uint8_t group;          // Ryhmän numero '@n:'
+    uint8_t color;          // Värin kirjain tai 0, kun ryhmä pimennetään
+} __packed;
+
+static struct edge_trace_entry edge_trace[EDGE_TRACE_SIZE];
+static uint32_t edge_trace_head;  // Kirjattuja vaihtoja yhteensä
+static uint32_t edge_trace_tail;  // Ensimmäinen vielä tulostamaton vaihto
+static struct k_spinlock edge_trace_lock;
+#endif
+
+// Asetetaan vaiheen kaikki LEDit kerralla, joten vaihtojen väliin ei jää
+// pimeää hetkeä eikä kahden vaiheen sekoitusta. color on vain jäljitystä varten.
+static void signal_phase_apply(const struct signal_phase *phase, uint8_t group_id, char color) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_EDGE_TRACE
+    timing_t start = timing_counter_get();
+    uint32_t clock = k_cycle_get_32();
+#else
+    ARG_UNUSED(group_id);
+    ARG_UNUSED(color);
+#endif
+
+    for (int p = 0; p < phase->port_count; p++) {
+        gpio_port_set_masked(phase->ports[p].port, phase->ports[p].mask, phase->ports[p].value);
+    }
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_EDGE_TRACE
+    timing_t end = timing_counter_get();
+    uint64_t write_cycles = timing_cycles_get(&start, &end);
+    k_spinlock_key_t key = k_spin_lock(&edge_trace_lock);
+    struct edge_trace_entry *entry = &edge_trace[edge_trace_head & (EDGE_TRACE_SIZE - 1)];
+
+    entry->cycles = (uint32_t)start;
+    entry->clock = clock;
+    entry->write_cycles = MIN(write_cycles, UINT16_MAX);
+    entry->group = group_id;
+    entry->color = (uint8_t)color;
+    edge_trace_head++;
+    k_spin_unlock(&edge_trace_lock, key);
+#endif
+}
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+// Luetaan vaiheen pinnit takaisin. Yksi porttiluku porttia kohden, joten
+// tarkistus maksaa vaihdossa vain muutaman mikrosekunnin.
+static bool signal_phase_verify(const struct signal_phase *phase) {
+    for (int p = 0; p < phase->port_count; p++) {
+        gpio_port_value_t value;
+
+        if (gpio_port_get(phase->ports[p].port, &value) != 0 ||
+            ((value ^ phase->ports[p].value) & phase->ports[p].verify) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_EDGE_TRACE
+// Tulostetaan jäljitys binäärilohkoina (X,?). Lohko mahtuu kokonaan
+// lähetysrenkaaseen ja kirjoitetaan yhdellä kertaa, joten muu tuloste voi
+// osua vain lohkojen väliin. Lohko: SYNC 0xA5, 'X', määrä (u16), perässä
+// tulevat (u16), hukatut (u32, vain ensimmäisessä), laskurin taajuus (u32),
+// järjestelmäkellon taajuus (u32), merkinnät (cycles u32, clock u32,
+// write_cycles u16, group u8, color u8) ja CRC-16 kuten kehyksissä kaikesta
+// SYNCin jälkeisestä. Kentät little-endian, CRC big-endian.
+#define EDGE_TRACE_BLOCK_ENTRIES 32
+#define EDGE_TRACE_HEADER_LEN 17
+#define EDGE_TRACE_BLOCK_LEN \
+    (1 + EDGE_TRACE_HEADER_LEN + EDGE_TRACE_BLOCK_ENTRIES * sizeof(struct edge_trace_entry) + FRAME_CRC_LEN)
+BUILD_ASSERT(EDGE_TRACE_BLOCK_LEN <= UART_TX_RING_SIZE, "Edge trace block must fit in the UART TX ring");
+
+static uint8_t edge_trace_block[EDGE_TRACE_BLOCK_LEN];  // Vain komentojen käsittelijä käyttää
+
+static void edge_trace_dump(void) {
+    k_spinlock_key_t key = k_spin_lock(&edge_trace_lock);
+    uint32_t head = edge_trace_head;
+    uint32_t tail = edge_trace_tail;
+    uint32_t lost = 0;
+
+    // Vanhimmat merkinnät on jo kirjoitettu yli
+    if (head - tail > EDGE_TRACE_SIZE) {
+        lost = head - tail - EDGE_TRACE_SIZE;
+        tail = head - EDGE_TRACE_SIZE;
+    }
+    edge_trace_tail = head;
+    k_spin_unlock(&edge_trace_lock, key);
+
+    // Tyhjästäkin jäljityksestä lähetetään yksi lohko
+    do {
+        uint32_t count = MIN(head - tail, EDGE_TRACE_BLOCK_ENTRIES);
+        uint8_t *buf = edge_trace_block;
+
+        buf[0] = FRAME_SYNC;
+        buf[1] = 'X';
+        sys_put_le16((uint16_t)count, &buf[2]);
+        sys_put_le16((uint16_t)(head - tail - count), &buf[4]);
+        sys_put_le32(lost, &buf[6]);
+        sys_put_le32((uint32_t)timing_freq_get(), &buf[10]);
+        sys_put_le32(sys_clock_hw_cycles_per_sec(), &buf[14]);
+        buf += 1 + EDGE_TRACE_HEADER_LEN;
+
+        // Kopioidaan merkintä kerrallaan, jotta vaihtoja ei estetä pitkään
+        for (uint32_t i = 0; i < count; i++, tail++) {
+            struct edge_trace_entry entry;
+
+            key = k_spin_lock(&edge_trace_lock);
+            entry = edge_trace[tail & (EDGE_TRACE_SIZE - 1)];
+            k_spin_unlock(&edge_trace_lock, key);
+
+            sys_put_le32(entry.cycles, &buf[0]);
+            sys_put_le32(entry.clock, &buf[4]);
+            sys_put_le16(entry.write_cycles, &buf[8]);
+            buf[10] = entry.group;
+            buf[11] = entry.color;
+            buf += sizeof(entry);
+        }
+
+        uint16_t crc = crc16_itu_t(0xFFFF, &edge_trace_block[1], buf - &edge_trace_block[1]);
+        sys_put_be16(crc, buf);
+        buf += FRAME_CRC_LEN;
+        uart_tx_write_block(edge_trace_block, buf - edge_trace_block, K_FOREVER);
+        lost = 0;
+    } while (tail != head);
+}
+
+static void edge_trace_clear(void) {
+    k_spinlock_key_t key = k_spin_lock(&edge_trace_lock);
+    edge_trace_tail = edge_trace_head;
+    k_spin_unlock(&edge_trace_lock, key);
+}
+#endif
+
+// GPIO-initialisointifunktio
+int init_gpio(void) {
+    signal_leds_present = 0;
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+    signal_leds_readback = 0;
+#endif
+    for (size_t i = 0; i < ARRAY_SIZE(signal_leds); i++) {
+        if (signal_leds[i].port == NULL) {
+            continue;
+        }
+        if (!device_is_ready(signal_leds[i].port)) {
+            LOG_ERR("LED %u device not ready!", (unsigned int)i);
+            return -1;
+        }
+        int ret = gpio_pin_configure_dt(&signal_leds[i], GPIO_OUTPUT_INACTIVE | SIGNAL_LED_READBACK);
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+        // Kaikki ohjaimet eivät salli lähtöä ja tuloa yhtä aikaa: silloin
+        // pinni ohjataan pelkkänä lähtönä eikä sitä lueta takaisin
+        if (ret == 0) {
+            signal_leds_readback |= BIT(i);
+        } else {
+            LOG_WRN("LED %u readback unavailable (%d)", (unsigned int)i, ret);
+            ret = gpio_pin_configure_dt(&signal_leds[i], GPIO_OUTPUT_INACTIVE);
+        }
+#endif
+        if (ret != 0) {
+            LOG_ERR("LED %u configuration failed (%d)", (unsigned int)i, ret);
+            return -1;
+        }
+        signal_leds_present |= BIT(i);
+    }
+
+    // Ensimmäisen ryhmän punainen ja vihreä tarvitaan aina
+    if ((signal_leds_present & (BIT(0) | BIT(1))) != (BIT(0) | BIT(1))) {
+        LOG_ERR("One or more LED devices not ready!");
+        return -1;
+    }
+
+    LOG_INF("GPIOs initialized successfully");
+    return 0;
+}
+#endif /* !CONFIG_TRAFFIC_SIGNALS_NETCORE */
+
+// Rivijonon alustus
+void line_queue_init(struct line_queue *q) {
+    atomic_set(&q->head, 0);
+    atomic_set(&q->tail, 0);
+    atomic_set(&q->overflow_count, 0);
+    k_sem_init(&q->data_sem, 0, K_SEM_MAX_LIMIT);
+}
+
+static void line_queue_write(struct line_queue *q, uint32_t pos, const void *src, size_t len) {
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < len; i++) {
+        q->buffer[(pos + i) & (LINE_QUEUE_SIZE - 1)] = bytes[i];
+    }
+}
+
+static void line_queue_read(struct line_queue *q, uint32_t pos, void *dst, size_t len) {
+    uint8_t *bytes = dst;
+    for (size_t i = 0; i < len; i++) {
+        bytes[i] = q->buffer[(pos + i) & (LINE_QUEUE_SIZE - 1)];
+    }
+}
+
+// Rivijonon lisäysfunktio, palauttaa -ENOSPC jos rivi ei mahdu kokonaan
+int line_queue_put(struct line_queue *q, const char *msg, size_t len, enum line_type type,
+                   uint32_t received_cycles) {
+    uint32_t head = (uint32_t)atomic_get(&q->head);
+    uint32_t tail = (uint32_t)atomic_get(&q->tail);
+    uint32_t record_len = LINE_RECORD_HEADER_LEN + len;
+
+    if (len > UINT16_MAX || record_len > LINE_QUEUE_SIZE - (head - tail)) {
+        atomic_inc(&q->overflow_count);
+        return -ENOSPC;
+    }
+
+    struct line_record_header header = {
+        .len = (uint16_t)len,
+        .type = type,
+        .received_cycles = received_cycles,
+    };
+    line_queue_write(q, head, &header, LINE_RECORD_HEADER_LEN);
+    line_queue_write(q, head + LINE_RECORD_HEADER_LEN, msg, len);
+
+    // Tietue julkaistaan lukijalle vasta, kun se on kokonaan kirjoitettu
+    atomic_set(&q->head, (atomic_val_t)(head + record_len));
+    k_sem_give(&q->data_sem);
+    metrics_hwm(&metrics.line_queue_hwm, head + record_len - tail);
+    return 0;
+}
+
+// Rivijonon lukufunktio, palauttaa rivin pituuden tai -EAGAIN aikakatkaisussa
+int line_queue_get(struct line_queue *q, char *msg, size_t max_len, struct line_record_header *header_out,
+                   k_timeout_t timeout) {
+    if (k_sem_take(&q->data_sem, timeout) != 0) {
+        return -EAGAIN;
+    }
+
+    uint32_t tail = (uint32_t)atomic_get(&q->tail);
+    struct line_record_header header;
+    line_queue_read(q, tail, &header, LINE_RECORD_HEADER_LEN);
+
+    size_t copy_len = MIN((size_t)header.len, max_len - 1);
+    line_queue_read(q, tail + LINE_RECORD_HEADER_LEN, msg, copy_len);
+    msg[copy_len] = '\0'; // Lopetetaan merkkijono
+    *header_out = header;
+
+    atomic_set(&q->tail, (atomic_val_t)(tail + LINE_RECORD_HEADER_LEN + header.len));
+    return copy_len;
+}
+
+// Tulostetaan säikeen pinon käyttö (M,?). Käyttämätön osa lasketaan
+// CONFIG_INIT_STACKS-täytön perusteella, joten luku on käytön huippuarvo.
+#ifdef CONFIG_TRAFFIC_SIGNALS_STACK_USAGE
+static void stack_usage_print_thread(const struct k_thread *thread, void *user_data) {
+    ARG_UNUSED(user_data);
+    const char *name = k_thread_name_get((k_tid_t)thread);
+    size_t unused;
+
+    if (k_thread_stack_space_get(thread, &unused) != 0) {
+        return;
+    }
+    size_t size = thread->stack_info.size;
+    printk("%s: %u/%u bytes used\n", (name != NULL && name[0] != '\0') ? name : "?",
+           (unsigned int)(size - unused), (unsigned int)size);
+}
+#endif
+
+static void stack_usage_print(void) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_STACK_USAGE
+    // printk voi odottaa lähetyspuskuria, joten säikeet käydään läpi ilman lukkoa
+    k_thread_foreach_unlocked(stack_usage_print_thread, NULL);
+#else
+    printk("Stack usage reporting disabled (CONFIG_TRAFFIC_SIGNALS_STACK_USAGE)\n");
+#endif
+    // Jonojen ja slottien staattinen muisti; keosta ei varata mitään.
+    // Verkkoytimellä ryhmällä on vain käännöspuskuri.
+    int slots = IS_ENABLED(CONFIG_TRAFFIC_SIGNALS_NETCORE) ? 1 : SCHEDULE_SLOTS;
+    printk("schedules: %u bytes (%d groups x %d slots x %d steps), line queue: %u bytes, tx ring: %u bytes\n",
+           (unsigned int)(SIGNAL_GROUPS * slots * sizeof(struct sequence_program)), SIGNAL_GROUPS, slots,
+           MAX_PROGRAM_STEPS, (unsigned int)LINE_QUEUE_SIZE, (unsigned int)UART_TX_RING_SIZE);
+}
+
+// Säikeiden suoritinaikaprofiili (P,?). Jokainen raportti kattaa ajan
+// edellisestä raportista: suoritinajan osuus, vuoronvaihtojen määrä ja
+// niistä laskettu herätystiheys. Säikeen joka herää turhaan tunnistaa
+// siitä, että herätyksiä on paljon mutta aikaa kuluu vähän. Suoritinaika
+// mitataan ajoitusfunktioiden laskurilla (THREAD_RUNTIME_STATS_USE_TIMING_FUNCTIONS),
+// koska 32768 Hz:n järjestelmäkellolla lyhyt herätys näkyy nollana.
+// Vaihdot lasketaan suoraan tracing-koukusta, ei suoritusajoista.
+#ifdef CONFIG_TRAFFIC_SIGNALS_PROFILE
+#define PROFILE_THREADS 16
+#define PROFILE_STREAM_MIN_MS 100
+#define PROFILE_STREAM_MAX_MS 60000
+
+struct profile_entry {
+    const struct k_thread *thread;
+    uint64_t cycles;     // Suoritusjaksot raportin hetkellä
+    uint32_t switches;   // Vuoronvaihdot raportin hetkellä
+};
+
+struct profile_window {
+    uint64_t all_cycles;   // Kaikkien säikeiden jaksot ikkunan aikana
+    uint32_t window_ms;
+    size_t count;          // Uuteen lähtötasoon kirjatut säikeet
+};
+
+static struct profile_entry profile_baseline[PROFILE_THREADS];
+static struct profile_entry profile_next[PROFILE_THREADS];
+static size_t profile_baseline_count;
+static k_thread_runtime_stats_t profile_all_baseline;
+static int64_t profile_baseline_ms;
+static atomic_t profile_stream_ms;
+static K_MUTEX_DEFINE(profile_mutex);
+
+// Vuoronvaihdot säikeittäin. Laskurit kasvavat vain, joten raporttien
+// erotus on aina vaihtojen määrä (32 bitin ympäripyörähdys mukaan lukien).
+struct profile_switch_count {
+    const struct k_thread *thread;
+    uint32_t count;
+};
+
+static struct profile_switch_count profile_switch_counts[PROFILE_THREADS];
+
+// CONFIG_TRACING_USER kutsuu tätä jokaisessa vuoronvaihdossa
+// keskeytykset estettyinä, kun uusi säie on jo k_current_get
+void sys_trace_thread_switched_in_user(void) {
+    const struct k_thread *thread = k_current_get();
+
+    for (size_t i = 0; i < PROFILE_THREADS; i++) {
+        if (profile_switch_counts[i].thread == thread) {
+            profile_switch_counts[i].count++;
+            return;
+        }
+        if (profile_switch_counts[i].thread == NULL) {
+            profile_switch_counts[i].count = 1;
+            profile_switch_counts[i].thread = thread;
+            return;
+        }
+    }
+}
+
+static uint32_t profile_switches(const struct k_thread *thread) {
+    for (size_t i = 0; i < PROFILE_THREADS && profile_switch_counts[i].thread != NULL; i++) {
+        if (profile_switch_counts[i].thread == thread) {
+            return profile_switch_counts[i].count;
+        }
+    }
+    return 0;
+}
+
+static void profile_print_thread(const struct k_thread *thread, void *user_data) {
+    struct profile_window *window = user_data;
+    const char *name = k_thread_name_get((k_tid_t)thread);
+    k_thread_runtime_stats_t stats;
+    uint64_t cycles = 0;
+    uint32_t switches_then = 0;
+
+    if (k_thread_runtime_stats_get((k_tid_t)thread, &stats) != 0) {
+        return;
+    }
+    // Uudelle säikeelle lähtötaso on nolla, eli luvut kattavat sen koko eliniän
+    for (size_t i = 0; i < profile_baseline_count; i++) {
+        if (profile_baseline[i].thread == thread) {
+            cycles = profile_baseline[i].cycles;
+            switches_then = profile_baseline[i].switches;
+            break;
+        }
+    }
+    uint32_t switches_now = profile_switches(thread);
+    uint64_t cycles_delta = stats.execution_cycles - cycles;
+    uint32_t switches = switches_now - switches_then;
+    uint32_t cpu_permille = (window->all_cycles > 0) ? (uint32_t)(cycles_delta * 1000 / window->all_cycles) : 0;
+    uint32_t wakeups_per_s = (window->window_ms > 0) ? (uint32_t)((uint64_t)switches * 1000 / window->window_ms) : 0;
+
+    printk("PROF,%s,cpu=%u.%u%%,switches=%u,wakeups_per_s=%u\n",
+           (name != NULL && name[0] != '\0') ? name : "?", cpu_permille / 10, cpu_permille % 10, switches,
+           wakeups_per_s);
+
+    if (window->count < PROFILE_THREADS) {
+        profile_next[window->count].thread = thread;
+        profile_next[window->count].cycles = stats.execution_cycles;
+        profile_next[window->count].switches = switches_now;
+        window->count++;
+    }
+}
+
+static void profile_print(void) {
+    struct profile_window window = {0};
+    k_thread_runtime_stats_t now;
+
+    k_mutex_lock(&profile_mutex, K_FOREVER);
+    int64_t now_ms = k_uptime_get();
+    k_thread_runtime_stats_all_get(&now);
+    window.all_cycles = now.execution_cycles - profile_all_baseline.execution_cycles;
+    window.window_ms = (uint32_t)(now_ms - profile_baseline_ms);
+    uint64_t idle_cycles = now.idle_cycles - profile_all_baseline.idle_cycles;
+    uint32_t idle_permille = (window.all_cycles > 0) ? (uint32_t)(idle_cycles * 1000 / window.all_cycles) : 0;
+
+    printk("PROF,window_ms=%u,idle=%u.%u%%\n", window.window_ms, idle_permille / 10, idle_permille % 10);
+    // printk voi odottaa lähetyspuskuria, joten säikeet käydään läpi ilman lukkoa
+    k_thread_foreach_unlocked(profile_print_thread, &window);
+
+    memcpy(profile_baseline, profile_next, window.count * sizeof(profile_next[0]));
+    profile_baseline_count = window.count;
+    profile_all_baseline = now;
+    profile_baseline_ms = now_ms;
+    k_mutex_unlock(&profile_mutex);
+}
+
+static void profile_stream_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(profile_stream_work, profile_stream_handler);
+
+static void profile_stream_handler(struct k_work *work) {
+    ARG_UNUSED(work);
+    uint32_t period_ms = (uint32_t)atomic_get(&profile_stream_ms);
+
+    if (period_ms == 0) {
+        return;
+    }
+    profile_print();
+    k_work_reschedule(&profile_stream_work, K_MSEC(period_ms));
+}
+#endif
+
+// P,<ms> käynnistää jaksollisen raportin ja P,0 pysäyttää sen
+static void profile_stream_set(unsigned long period_ms) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_PROFILE
+    if (period_ms != 0 && (period_ms < PROFILE_STREAM_MIN_MS || period_ms > PROFILE_STREAM_MAX_MS)) {
+        printk("Profile period must be 0 or %u-%u ms\n", PROFILE_STREAM_MIN_MS, PROFILE_STREAM_MAX_MS);
+        return;
+    }
+    atomic_set(&profile_stream_ms, (atomic_val_t)period_ms);
+    if (period_ms == 0) {
+        k_work_cancel_delayable(&profile_stream_work);
+        printk("Profile streaming stopped\n");
+    } else {
+        k_work_reschedule(&profile_stream_work, K_MSEC(period_ms));
+        printk("Profile streaming every %lu ms\n", period_ms);
+    }
+#else
+    ARG_UNUSED(period_ms);
+    printk("Profiling disabled (CONFIG_TRAFFIC_SIGNALS_PROFILE)\n");
+#endif
+}
+
+// Ajonaikainen lokitason rajaus tälle moduulille (vaatii CONFIG_LOG_RUNTIME_FILTERING)
+static void set_log_level(uint32_t level) {
+#ifdef CONFIG_LOG_RUNTIME_FILTERING
+    log_filter_set(NULL, Z_LOG_LOCAL_DOMAIN_ID, LOG_CURRENT_MODULE_ID(), level);
+#else
+    ARG_UNUSED(level);
+    LOG_WRN("Runtime log filtering not enabled");
+#endif
+}
+
+// Käsitellään ohjauskomennot. Palauttaa false, jos rivi ei ole komento
+// vaan sekvenssi.
+static bool handle_command(const char *line) {
+    // Käsitellään 'D' komento debug-tilan vaihtamiseksi ja 'L' lokitason asettamiseksi
+    if (strcmp(line, "D,1") == 0) {
+        set_log_level(LOG_LEVEL_DBG);
+        printk("Debugging enabled\n");
+    } else if (strcmp(line, "D,0") == 0) {
+        set_log_level(DEFAULT_LOG_LEVEL);
+        printk("Debugging disabled\n");
+    } else if (line[0] == 'L' && line[1] == ',' && line[2] >= '0' && line[2] <= '4' && line[3] == '\0') {
+        set_log_level(line[2] - '0');
+        printk("Log level %c\n", line[2]);
+    } else if (line[0] == 'E' && line[1] == ',' && line[2] >= '0' && line[2] <= '2' && line[3] == '\0') {
+        atomic_set(&uart_echo_mode, line[2] - '0');
+        printk("Echo mode %c\n", line[2]);
+    } else if (strcmp(line, "S,?") == 0) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_NETCORE
+        // Suorittajan tilastot jäävät sovellusytimelle, niitä ei välitetä
+        printk("Network core statistics, executor statistics stay on the application core\n");
+#endif
+        metrics_print();
+    } else if (strcmp(line, "S,0") == 0) {
+        metrics_reset();
+        printk("Statistics reset\n");
+    } else if (strcmp(line, "M,?") == 0) {
+        stack_usage_print();
+    } else if (strcmp(line, "P,?") == 0) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_PROFILE
+#ifdef CONFIG_TRAFFIC_SIGNALS_NETCORE
+        printk("Network core threads only\n");
+#endif
+        profile_print();
+#else
+        printk("Profiling disabled (CONFIG_TRAFFIC_SIGNALS_PROFILE)\n");
+#endif
+    } else if (line[0] == 'P' && line[1] == ',' && line[2] >= '0' && line[2] <= '9') {
+        char *end;
+        unsigned long period_ms = strtoul(&line[2], &end, 10);
+        if (*end != '\0') {
+            return false;
+        }
+        profile_stream_set(period_ms);
+    } else if (strcmp(line, "N,1") == 0 || strcmp(line, "N,0") == 0) {
+        atomic_set(&signal_events_serial, line[2] == '1');
+        printk("Event reporting %s\n", (line[2] == '1') ? "enabled" : "disabled");
+    } else if (strcmp(line, "X,?") == 0 || strcmp(line, "X,0") == 0) {
+#ifdef CONFIG_TRAFFIC_SIGNALS_EDGE_TRACE
+        if (line[2] == '?') {
+            edge_trace_dump();
+        } else {
+            edge_trace_clear();
+            printk("Edge trace cleared\n");
+        }
+#elif defined(CONFIG_TRAFFIC_SIGNALS_NETCORE)
+        printk("Edge trace runs on the application core\n");
+#else
+        printk("Edge trace disabled (CONFIG_TRAFFIC_SIGNALS_EDGE_TRACE)\n");
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Tarkistetaan binäärikehyksen CRC ja viedään hyötykuorma rivijonoon
+static void receive_frame(const struct uart_line *frame) {
+    const uint8_t *data = (const uint8_t *)frame->data;
+    uint8_t payload_len = data[0];
+    uint16_t crc = crc16_itu_t(0xFFFF, data, 1 + payload_len);
+    uint16_t expected = ((uint16_t)data[1 + payload_len] << 8) | data[2 + payload_len];
+
+    if (crc != expected) {
+        LOG_WRN("Frame rejected: CRC 0x%04x, expected 0x%04x", crc, expected);
+        metrics_count(&metrics.frames_rejected, 1);
+        uart_tx_byte(FRAME_NAK);
+        return;
+    }
+
+    if (line_queue_put(&uart_line_queue, (const char *)&data[1], payload_len, LINE_FRAME, frame->end_cycles) != 0) {
+        LOG_WRN("Line queue full, frame dropped (%ld total)",
+                (long)atomic_get(&uart_line_queue.overflow_count));
+        metrics_count(&metrics.frames_rejected, 1);
+        uart_tx_byte(FRAME_NAK);
+    }
+    // Kuittaus lähetetään, kun dispatcher on kääntänyt kehyksen
+}
+
+// Hylätty tekstirivi ilmoitetaan kaiutustilan mukaan: kuittaustilassa NAK,
+// kaiutustilassa NAK ja syy omalla rivillään. Pois-tilassa vain lokiin.
+static void uart_rx_reject(int echo, const char *reason) {
+    if (echo == ECHO_ACK) {
+        uart_tx_byte(FRAME_NAK);
+    } else if (echo == ECHO_FULL) {
+        printk("NAK,%s\n", reason);
+    }
+}
+
+// UART-vastaanottotehtävä
+void uart_receive_task(void *p1, void *p2, void *p3) {
+    struct uart_line line;
+    LOG_INF("UART Receive Task Started");
+
+    while (true) {
+        // Odotetaan, että keskeytys on koonnut kokonaisen rivin
+        k_msgq_get(&uart_line_msgq, &line, K_FOREVER);
+
+        // Keskeytyksessä hylätyt rivit ilmoitetaan kuten muutkin hylätyt rivit
+        int echo = atomic_get(&uart_echo_mode);
+        int dropped = atomic_clear(&uart_rx_dropped_lines);
+        for (int i = 0; i < dropped; i++) {
+            uart_rx_reject(echo, "dropped");
+        }
+        if (dropped > 0) {
+            LOG_WRN("UART RX queue full, %d lines dropped", dropped);
+            metrics_count(&metrics.uart_rx_dropped, dropped);
+        }
+
+        // Kehykset kuitataan kaikissa tiloissa, joten jonon vuoksi
+        // hylätyt saavat NAKin kuten CRC-virheelliset
+        int dropped_frames = atomic_clear(&uart_rx_dropped_frames);
+        for (int i = 0; i < dropped_frames; i++) {
+            uart_tx_byte(FRAME_NAK);
+        }
+        if (dropped_frames > 0) {
+            LOG_WRN("UART RX queue full, %d frames dropped", dropped_frames);
+            metrics_count(&metrics.uart_rx_dropped, dropped_frames);
+            metrics_count(&metrics.frames_rejected, dropped_frames);
+        }
+
+        // Pituusvirheen tai tauon vuoksi jo keskeytyksessä hylätyt kehykset kuitataan
+        int bad_frames = atomic_clear(&uart_rx_bad_frames);
+        for (int i = 0; i < bad_frames; i++) {
+            uart_tx_byte(FRAME_NAK);
+        }
+        if (bad_frames > 0) {
+            LOG_WRN("%d frames rejected: bad length or byte timeout", bad_frames);
+            metrics_count(&metrics.frames_rejected, bad_frames);
+        }
+
+        if (line.type == LINE_FRAME) {
+            receive_frame(&line);
+            continue;
+        }
+
+        // Liian pitkä rivi: dispatcher saa tiedon, jotta kesken oleva
+        // BEGIN/END-lähetys hylätään eikä jatku rivi puuttuvana
+        if (line.type == LINE_OVERLONG) {
+            LOG_WRN("Line longer than %d characters discarded", MAX_MSG_LEN - 1);
+            metrics_count(&metrics.uart_rx_overlong, 1);
+            line_queue_put(&uart_line_queue, "", 0, LINE_OVERLONG, line.end_cycles);
+            uart_rx_reject(echo, "overlong");
+            continue;
+        }
+
+        // Kaiutus ei odota: täydestä puskurista kaiutus jää pois, rivi ei
+        if (echo == ECHO_FULL) {
+            uart_tx_write(line.data, strlen(line.data), K_NO_WAIT);
+            uart_tx_write("\r\n", 2, K_NO_WAIT);
+        }
+
+        bool accepted = true;
+        if (!handle_command(line.data)) {
+            // Vastaanottoaika ensimmäisestä merkistä rivin loppuun
+            uint32_t duration_cycles = line.end_cycles - line.start_cycles;
+            uint32_t duration_ns = k_cyc_to_ns_floor64(duration_cycles);
+            uint32_t duration_us = duration_ns / 1000;
+            LOG_DBG("UART sequence received in %u us", duration_us);  // Raportoidaan vastaanottoaika
+
+            // Asetetaan koko viesti rivijonoon, täydestä jonosta ilmoitetaan
+            if (line_queue_put(&uart_line_queue, line.data, line.len, LINE_TEXT, line.end_cycles) != 0) {
+                LOG_WRN("Line queue full, sequence dropped (%ld total)",
+                        (long)atomic_get(&uart_line_queue.overflow_count));
+                accepted = false;
+            }
+        }
+        if (!accepted) {
+            uart_rx_reject(echo, "dropped");
+        } else if (echo == ECHO_ACK) {
+            uart_tx_byte(FRAME_ACK);
+        }
+    }
+}
+
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+// Ajastinohjattu suorittaja. Valojen vaihdot ja niiden lokitus tehdään
+// k_timerin päättymisfunktiossa, ja jokaisen askeleen loppuhetki lasketaan
+// absoluuttisena tikkinä aikajanan alusta (base_ticks + kaikkien
+// edeltävien askelten kesto), joten pyöristys- ja viivevirheet eivät
+// kasaannu pitkässäkään sekvenssissä.
+struct executor {
+    struct sequence_program *program;  // Suorituksessa oleva ohjelma tai NULL
+    uint16_t step_index;
+    uint16_t repeat_index;
+    bool waiting;                // Ei askelta käynnissä: ei ohjelmaa tai askel julkaisematta
+    int64_t base_ticks;          // Aikajanan alku
+    uint64_t elapsed_ms;         // Aloitettujen askelten yhteenlaskettu kesto
+    int64_t deadline_ticks;      // Nykyisen askeleen loppuhetki
+    int64_t max_deadline_ticks;  // Ilmaisinaskeleen myöhäisin loppuhetki
+    int64_t cycle_start_ticks;   // Nykyisen kierron (toiston) alkuhetki
+    bool cycle_hold;             // Viimeistä askelta pidetään kierron alkuun
+    uint32_t step_start_cycles;  // Nykyisen askeleen toteutunut alkuhetki
+    bool first_edge_pending;     // Ohjelman ensimmäistä vaihtoa ei ole vielä mitattu
+    uint32_t total_duration_us;  // Ohjelman askelten toteutunut kesto yhteensä
+    const struct signal_phase *override_phase;  // Ohitusvaihe tai NULL
+    int64_t override_end_ticks;  // Ohituksen loppu, INT64_MAX = kunnes !> tai !X
+};
+
+// Opastinryhmä: oma LED-joukko, aikatauluslotit ja suorittajan tila.
+// Aktiivinen slotti soi, ja uusi sekvenssi käännetään valmiustilaslottiin.
+// Jos vapaata slottia ei ole, uusin valmiustilassa odottava aikataulu
+// korvataan, joten dispatcher ei koskaan jää odottamaan.
+struct signal_group {
+    uint8_t id;                  // Osoite '@n:', 1..SIGNAL_GROUPS
+    uint32_t colors_available;   // signal_colors-indeksit, joiden LEDit ryhmällä on
+    struct signal_phase color_phases[ARRAY_SIZE(signal_colors)];
+    struct signal_phase dark_phase;
+    struct executor executor;
+    struct sequence_program slots[SCHEDULE_SLOTS];
+    uint32_t upload_seq;         // Viimeksi valmiustilaan siirretyn ohjelman numero
+    uint32_t persisted_seq;      // Viimeksi tallennettu ohjelma, vain työjono käyttää
+    atomic_t programs_pending;   // Valmiustilassa tai suorituksessa olevat ohjelmat
+    atomic_t swap_request;       // enum swap_request
+};
+
+// Kaikkia ryhmiä palvelee sama suorittaja ja yksi ajastin, joka asetetaan
+// aina lähimpään askeleen loppuhetkeen
+static struct signal_group signal_groups[SIGNAL_GROUPS];
+static struct k_spinlock executor_lock;
+static struct k_timer executor_timer;
+
+// Käynnistetty aikataulu tallennetaan flashiin työjonossa, ei ajastimessa
+static struct k_work schedule_persist_work;
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+// Vikatila: kaikki ryhmät vilkuttavat keltaista (tai punaista, jos ryhmällä
+// ei ole keltaista) omalla ajastimellaan, kunnes FAULT,0 kuittaa vian.
+// Aikataulut säilyvät, joten kuittauksen jälkeen jatketaan katkaistusta
+// askeleesta ilman uudelleenkäynnistystä tai -lähetystä.
+enum fault_cause {
+    FAULT_NONE,
+    FAULT_READBACK,  // Pinnien tila ei vastaa asetettua vaihetta
+    FAULT_STALL,     // Suorittajan ajastin ei herännyt askelrajalla
+};
+
+static const char *const fault_cause_names[] = {
+    [FAULT_NONE] = "none",
+    [FAULT_READBACK] = "readback mismatch",
+    [FAULT_STALL] = "executor stall",
+};
+
+// Luetaan ja kirjoitetaan executor_lockin sisällä
+static uint8_t fault_cause;       // enum fault_cause, FAULT_NONE = ei vikaa
+static uint8_t fault_group_id;    // Ryhmä, jossa vika havaittiin
+static uint32_t fault_count;      // Havaitut viat käynnistyksestä
+static int64_t fault_since_ms;    // Vikatilan alku
+static bool fault_flash_on;
+static uint32_t fault_flash_count;  // Vilkun vaihdot, valvonta seuraa etenemistä
+static struct k_timer fault_flash_timer;
+
+static void fault_enter(struct signal_group *group, enum fault_cause cause);
+#endif
+
+// Yhteinen aikakanta koordinoiduille kierroille: aikakannan hetki 0
+// paikallisina tikkeinä. SYNC,<t> asettaa sen ja 1PPS-tulo tarkentaa sitä
+// joka sekunti. Luetaan ja kirjoitetaan executor_lockin sisällä.
+static int64_t coord_epoch_ticks;
+static bool coord_synced;
+static int32_t coord_pps_error_us;  // Viimeisin 1PPS-korjaus
+
+#define COORD_PPS_SPEC GPIO_DT_SPEC_GET_OR(DT_ALIAS(sync_pps), gpios, {0})
+static const struct gpio_dt_spec coord_pps = COORD_PPS_SPEC;
+static struct gpio_callback coord_pps_cb;
+
+// Ryhmän väri tai NULL, jos väriä ei ole tai ryhmältä puuttuu sen LED
+static const struct signal_color *signal_group_color(const struct signal_group *group, char color) {
+    const struct signal_color *entry = find_signal_color(color);
+
+    if (entry == NULL || !(group->colors_available & BIT(entry - signal_colors))) {
+        return NULL;
+    }
+    return entry;
+}
+
+// Lasketaan ryhmien LED-joukot ja vaiheet. Ryhmä n käyttää aliaksia
+// led(n-1)*SIGNAL_GROUP_LEDS alkaen; ryhmä ilman LEDejä jää käyttämättä.
+static int signal_groups_init(void) {
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        struct signal_group *group = &signal_groups[g];
+        unsigned int shift = g * SIGNAL_GROUP_LEDS;
+        uint32_t group_leds = signal_leds_present & (BIT_MASK(SIGNAL_GROUP_LEDS) << shift);
+
+        group->id = g + 1;
+        group->executor.waiting = true;
+        group->colors_available = 0;
+
+        if (signal_phase_build(group_leds, 0, &group->dark_phase) != 0) {
+            LOG_ERR("Group %u LEDs use more than %d GPIO ports", group->id, MAX_LED_PORTS);
+            return -1;
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(signal_colors); i++) {
+            uint32_t leds = signal_colors[i].leds << shift;
+            if ((leds & ~group_leds) == 0) {
+                signal_phase_build(group_leds, leds, &group->color_phases[i]);
+                group->colors_available |= BIT(i);
+            }
+        }
+        for (int s = 0; s < SCHEDULE_SLOTS; s++) {
+            group->slots[s].group = group;
+        }
+        if (group->colors_available != 0) {
+            LOG_INF("Signal group %u ready", group->id);
+        }
+    }
+    return 0;
+}
+
+// Ryhmä osoitteella id tai NULL, jos ryhmää ei ole tai sillä ei ole LEDejä
+static struct signal_group *find_signal_group(unsigned int id) {
+    if (id < 1 || id > SIGNAL_GROUPS || signal_groups[id - 1].colors_available == 0) {
+        return NULL;
+    }
+    return &signal_groups[id - 1];
+}
+
+// Ohjelma loppui tai keskeytettiin: vapautetaan sen slotti
+static void executor_retire(struct signal_group *group, bool aborted) {
+    struct executor *exec = &group->executor;
+
+    if (aborted) {
+        LOG_WRN("[%u] Sequence aborted", group->id);
+        signal_event_post(SIGNAL_EVENT_ERROR, group->id, exec->program->upload_seq, exec->step_index,
+                          exec->program->error);
+    } else {
+        signal_event_post(SIGNAL_EVENT_DONE, group->id, exec->program->upload_seq, exec->step_index,
+                          exec->total_duration_us);
+    }
+    // Tulostetaan sekvenssin yhteenlaskettu aika
+    LOG_DBG("[%u] Total sequence duration: %u us", group->id, exec->total_duration_us);
+    exec->program->slot_state = SLOT_FREE;
+    exec->program = NULL;
+    atomic_dec(&group->programs_pending);
+}
+
+// Vanhin valmiustilassa odottava aikataulu tai NULL
+static struct sequence_program *executor_find_standby(struct signal_group *group) {
+    struct sequence_program *oldest = NULL;
+
+    for (int i = 0; i < SCHEDULE_SLOTS; i++) {
+        struct sequence_program *slot = &group->slots[i];
+        if (slot->slot_state == SLOT_STANDBY &&
+            (oldest == NULL || (int32_t)(slot->upload_seq - oldest->upload_seq) < 0)) {
+            oldest = slot;
+        }
+    }
+    return oldest;
+}
+
+// Tarkistetaan askel- tai kierrosrajalla, pyydettiinkö vaihtoa. Jos
+// pyyntö koskee tätä rajaa ja valmiustilassa on aikataulu, aktiivinen
+// aikataulu lopetetaan ja seuraava askel otetaan valmiustilaslotista.
+static bool executor_swap_due(struct signal_group *group, bool cycle_boundary) {
+    atomic_val_t request = atomic_get(&group->swap_request);
+
+    if (request == SWAP_NONE || (request == SWAP_CYCLE && !cycle_boundary)) {
+        return false;
+    }
+    atomic_set(&group->swap_request, SWAP_NONE);
+    if (executor_find_standby(group) == NULL) {
+        LOG_WRN("[%u] Swap ignored: no standby schedule", group->id);
+        return false;
+    }
+    LOG_INF("[%u] Swapping to standby schedule", group->id);
+    executor_retire(group, false);
+    return true;
+}
+
+// Ilmaisimen havainto jatkaa askelta aukkoajan verran, enintään
+// maksimikestoon. Aikajana siirtyy samalla, joten seuraavat askeleet eivät
+// lyhene. Kutsutaan executor_lockin sisällä.
+static void executor_extend(struct signal_group *group, int64_t now) {
+    struct executor *exec = &group->executor;
+    int64_t deadline = MIN(now + (int64_t)k_ms_to_ticks_ceil64(CONFIG_TRAFFIC_SIGNALS_DETECTOR_GAP_MS),
+                           exec->max_deadline_ticks);
+
+    if (deadline > exec->deadline_ticks) {
+        exec->base_ticks += deadline - exec->deadline_ticks;
+        exec->deadline_ticks = deadline;
+        LOG_DBG("[%u] Step extended", group->id);
+    }
+}
+
+static void executor_start_step(struct signal_group *group) {
+    struct executor *exec = &group->executor;
+    const struct sequence_step *step = &exec->program->steps[exec->step_index];
+    const struct signal_color *color = find_signal_color(step->color);
+
+    if (exec->step_index == 0) {
+        exec->cycle_start_ticks = exec->base_ticks + k_ms_to_ticks_ceil64(exec->elapsed_ms);
+    }
+
+    signal_phase_apply(&group->color_phases[color - signal_colors], group->id, color->color);
+    exec->step_start_cycles = k_cycle_get_32();
+
+    if (exec->first_edge_pending) {
+        exec->first_edge_pending = false;
+        metrics_record(&metrics.dispatch_to_edge,
+                       k_cyc_to_us_floor32(exec->step_start_cycles - exec->program->dispatch_cycles));
+    }
+
+    exec->elapsed_ms += step->duration;
+    exec->deadline_ticks = exec->base_ticks + k_ms_to_ticks_ceil64(exec->elapsed_ms);
+    exec->max_deadline_ticks = exec->deadline_ticks + k_ms_to_ticks_ceil64(step->max_duration - step->duration);
+    exec->waiting = false;
+
+    // Ilmaisimella jo oleva ajoneuvo ei tuota reunaa, joten tila luetaan kerran
+    if (step->detector != 0 && gpio_pin_get_dt(&signal_detectors[step->detector - 1]) > 0) {
+        executor_extend(group, k_uptime_ticks());
+    }
+
+    LOG_INF("[%u] %s light ON for %u ms", group->id, color->name, step->duration);
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+    if (!signal_phase_verify(&group->color_phases[color - signal_colors])) {
+        fault_enter(group, FAULT_READBACK);
+    }
+#endif
+}
+
+// Siirrytään ryhmän seuraavaan askeleeseen. Kutsutaan executor_lockin sisällä
+// joko askeleen loppuhetkellä (at_deadline) tai dispatcherin herätteestä.
+static void executor_advance(struct signal_group *group, bool at_deadline) {
+    struct executor *exec = &group->executor;
+    int64_t now = k_uptime_ticks();
+
+    // Ohituksen aikana ohjelma odottaa, vaikka askelia julkaistaisiin
+    if (exec->override_phase != NULL) {
+        return;
+    }
+
+    // Odottamassa ollut ohjelma jatkaa aikajanaa tästä hetkestä
+    if (!at_deadline && exec->program != NULL) {
+        exec->base_ticks = now - k_ms_to_ticks_ceil64(exec->elapsed_ms);
+    }
+
+    while (true) {
+        struct sequence_program *program = exec->program;
+
+        if (program == NULL) {
+            program = executor_find_standby(group);
+            if (program == NULL) {
+                signal_phase_apply(&group->dark_phase, group->id, 0);
+                exec->waiting = true;
+                return;
+            }
+            program->slot_state = SLOT_ACTIVE;
+            k_work_submit(&schedule_persist_work);
+            exec->program = program;
+            exec->step_index = 0;
+            exec->repeat_index = 0;
+            exec->elapsed_ms = 0;
+            exec->first_edge_pending = true;
+            // Heti edellisen perään alkava ohjelma jatkaa samaa aikajanaa
+            exec->base_ticks = at_deadline ? exec->deadline_ticks : now;
+            exec->total_duration_us = 0;
+            exec->cycle_hold = false;
+            signal_event_post(SIGNAL_EVENT_STARTED, group->id, program->upload_seq, 0, 0);
+        }
+
+        atomic_val_t state = atomic_get(&program->state);
+        if (state == PROGRAM_ABORTED) {
+            executor_retire(group, true);
+            continue;
+        }
+        // Vaihto ajastimen askelrajalla, jolloin valot eivät ehdi sammua
+        if (at_deadline && exec->step_index > 0 && executor_swap_due(group, false)) {
+            continue;
+        }
+        if (exec->step_index < atomic_get(&program->ready_steps)) {
+            executor_start_step(group);
+            return;
+        }
+        if (state == PROGRAM_OPEN) {
+            // Dispatcher ei ole vielä julkaissut seuraavaa askelta
+            exec->waiting = true;
+            return;
+        }
+        if (at_deadline && executor_swap_due(group, true)) {
+            continue;
+        }
+        if (++exec->repeat_index < program->repeat_times) {
+            exec->step_index = 0;
+            continue;
+        }
+        executor_retire(group, false);
+    }
+}
+
+// Lähin koordinoidun kierron alku hetkestä at (tikkeinä). Kierrot alkavat
+// aikakannan hetkinä offset + k * cycle.
+static int64_t coord_nearest_boundary(int64_t at, uint32_t cycle_ms, uint32_t offset_ms) {
+    uint64_t timebase_ms = k_ticks_to_ms_near64(MAX(at - coord_epoch_ticks, 0));
+    uint64_t k = (timebase_ms + cycle_ms - offset_ms) / cycle_ms;
+    int64_t next = coord_epoch_ticks + (int64_t)k_ms_to_ticks_near64(k * cycle_ms + offset_ms);
+    int64_t prev = next - (int64_t)k_ms_to_ticks_near64(cycle_ms);
+
+    return (next - at < at - prev) ? next : prev;
+}
+
+// Koordinoidun kierron viimeistä askelta pidetään, kunnes seuraava kierto
+// alkaa aikakannan mukaan. Virhe korjataan enintään SLEW_PERCENT kierron
+// pituudesta kierrossa ja vain pitoa muuttamalla, joten ohjelmoituja
+// kestoja ei lyhennetä. Jos kierrossa ei ole väljyyttä, myöhästyminen
+// korjataan pidentämällä kiertoja kohti seuraavaa alkua. Palauttaa true,
+// jos askelta jatkettiin. Kutsutaan executor_lockin sisällä.
+static bool executor_cycle_hold(struct signal_group *group) {
+    struct executor *exec = &group->executor;
+    const struct sequence_program *program = exec->program;
+
+    if (exec->cycle_hold || atomic_get(&program->state) != PROGRAM_CLOSED || program->cycle_ms == 0 ||
+        exec->step_index + 1 != program->step_count) {
+        return false;
+    }
+
+    int64_t cycle = k_ms_to_ticks_near64(program->cycle_ms);
+    int64_t slew = cycle * CONFIG_TRAFFIC_SIGNALS_COORD_SLEW_PERCENT / 100;
+    int64_t end = exec->deadline_ticks;
+    int64_t target = exec->cycle_start_ticks + cycle;
+    int64_t boundary = coord_nearest_boundary(target, program->cycle_ms, program->offset_ms);
+
+    // Alle millisekunnin myöhästymistä (tikkien pyöristys) ei korjata
+    if (boundary < end - (int64_t)k_ms_to_ticks_ceil64(1)) {
+        boundary += cycle;
+    }
+    int64_t start = MAX(target + CLAMP(boundary - target, -slew, slew), end);
+    if (start <= end) {
+        return false;
+    }
+    exec->base_ticks += start - end;
+    exec->deadline_ticks = start;
+    exec->cycle_hold = true;
+    LOG_DBG("[%u] Cycle hold %u ms", group->id, (uint32_t)k_ticks_to_ms_near64(start - end));
+    return true;
+}
+
+// Ohitus päättyy: ryhmä jatkaa katkaistusta askeleesta tai seuraavasta
+// valmiustilan aikataulusta. Kutsutaan executor_lockin sisällä.
+static void executor_override_finish(struct signal_group *group) {
+    group->executor.override_phase = NULL;
+    LOG_INF("[%u] Override ended", group->id);
+    executor_advance(group, false);
+}
+
+// Ryhmän seuraava ajastettu hetki tai INT64_MAX
+static int64_t executor_next_deadline(const struct executor *exec) {
+    if (exec->override_phase != NULL) {
+        return exec->override_end_ticks;
+    }
+    if (exec->program != NULL && !exec->waiting) {
+        return exec->deadline_ticks;
+    }
+    return INT64_MAX;
+}
+
+// Asetetaan ajastin lähimpään askeleen loppuhetkeen kaikista ryhmistä
+static void executor_reschedule(void) {
+    int64_t next = INT64_MAX;
+
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        next = MIN(next, executor_next_deadline(&signal_groups[g].executor));
+    }
+
+    if (next == INT64_MAX) {
+        k_timer_stop(&executor_timer);
+    } else {
+        k_timer_start(&executor_timer, K_TIMEOUT_ABS_TICKS(next), K_NO_WAIT);
+    }
+}
+
+// Askeleen loppuhetki: kirjataan päättyneet askeleet ja vaihdetaan seuraaviin
+static void executor_timer_expiry(struct k_timer *timer) {
+    ARG_UNUSED(timer);
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    int64_t now = k_uptime_ticks();
+
+    metrics_count(&metrics.timer_wakes, 1);
+
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        struct signal_group *group = &signal_groups[g];
+        struct executor *exec = &group->executor;
+
+        if (executor_next_deadline(exec) > now) {
+            continue;
+        }
+        if (exec->override_phase != NULL) {
+            executor_override_finish(group);
+            continue;
+        }
+        if (executor_cycle_hold(group)) {
+            continue;
+        }
+        bool held = exec->cycle_hold;
+        exec->cycle_hold = false;
+
+        const struct sequence_step *step = &exec->program->steps[exec->step_index];
+        uint32_t duration_cycles = k_cycle_get_32() - exec->step_start_cycles;
+        uint32_t duration_us = k_cyc_to_ns_floor64(duration_cycles) / 1000;
+
+        exec->total_duration_us += duration_us;
+        // Ilmaisinaskeleen ja pidetyn askeleen kesto vaihtelee, joten vain
+        // kiinteät askeleet mitataan
+        if (step->detector == 0 && !held) {
+            int64_t dwell_error = (int64_t)duration_us - (int64_t)step->duration * 1000;
+            metrics_record(&metrics.dwell_error,
+                           (uint32_t)MIN(dwell_error < 0 ? -dwell_error : dwell_error, UINT32_MAX));
+        }
+        LOG_INF("[%u] %s light OFF, task duration: %u us", group->id, find_signal_color(step->color)->name,
+                duration_us);
+        signal_event_post(SIGNAL_EVENT_STEP_DONE, group->id, exec->program->upload_seq, exec->step_index,
+                          duration_us);
+        exec->step_index++;
+        executor_advance(group, true);
+    }
+    executor_reschedule();
+
+    k_spin_unlock(&executor_lock, key);
+}
+
+// Dispatcher ilmoittaa ryhmän uusista askeleista tai ohjelmista
+static void executor_kick(struct signal_group *group) {
+    struct executor *exec = &group->executor;
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+
+    if (exec->program != NULL && atomic_get(&exec->program->state) == PROGRAM_ABORTED) {
+        // Keskeytetty ohjelma lopetetaan heti eikä vasta askeleen lopussa
+        executor_retire(group, true);
+        executor_advance(group, false);
+    } else if (exec->waiting) {
+        executor_advance(group, false);
+    }
+    executor_reschedule();
+
+    k_spin_unlock(&executor_lock, key);
+}
+
+// Pyydetään ryhmää vaihtamaan valmiustilan aikatauluun
+static void group_request_swap(struct signal_group *group, enum swap_request request) {
+    atomic_set(&group->swap_request, request);
+}
+
+// Ilmaisintulon reuna: jatketaan ryhmiä, joiden käynnissä oleva askel
+// seuraa tätä tuloa. Ei omaa säiettä eikä pollausta, vain GPIO-keskeytys.
+static struct gpio_callback signal_detector_cb[DETECTOR_INPUTS];
+
+static void signal_detector_isr(const struct device *port, struct gpio_callback *cb, gpio_port_pins_t pins) {
+    ARG_UNUSED(port);
+    ARG_UNUSED(pins);
+    uint8_t input = (cb - signal_detector_cb) + 1;
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    int64_t now = k_uptime_ticks();
+
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        struct signal_group *group = &signal_groups[g];
+        const struct executor *exec = &group->executor;
+
+        if (exec->program != NULL && !exec->waiting && exec->program->steps[exec->step_index].detector == input) {
+            executor_extend(group, now);
+        }
+    }
+    executor_reschedule();
+
+    k_spin_unlock(&executor_lock, key);
+}
+
+// Asetetaan aikakanta: hetkellä at_ticks aikakanta oli timebase_ms.
+// Käynnissä olevat kierrot siirtyvät uuteen aikakantaan pitoa säätämällä.
+static void coord_sync(uint64_t timebase_ms, int64_t at_ticks) {
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    coord_epoch_ticks = at_ticks - (int64_t)k_ms_to_ticks_near64(timebase_ms);
+    coord_synced = true;
+    k_spin_unlock(&executor_lock, key);
+}
+
+// 1PPS-reuna on aikakannan tasasekunti: siirretään aikakanta lähimpään
+// sekuntiin. Yksittäinen korjaus on alle puoli sekuntia.
+static void coord_pps_isr(const struct device *port, struct gpio_callback *cb, gpio_port_pins_t pins) {
+    ARG_UNUSED(port);
+    ARG_UNUSED(cb);
+    ARG_UNUSED(pins);
+    int64_t second = k_ms_to_ticks_near64(MSEC_PER_SEC);
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    int64_t phase = (k_uptime_ticks() - coord_epoch_ticks) % second;
+
+    if (phase < 0) {
+        phase += second;
+    }
+    if (phase > second / 2) {
+        phase -= second;
+    }
+    coord_epoch_ticks += phase;
+    coord_pps_error_us = (phase < 0) ? -(int32_t)k_ticks_to_us_floor64(-phase) : (int32_t)k_ticks_to_us_floor64(phase);
+    k_spin_unlock(&executor_lock, key);
+}
+
+static int coord_pps_init(void) {
+    if (coord_pps.port == NULL) {
+        return 0;
+    }
+    if (!gpio_is_ready_dt(&coord_pps)) {
+        LOG_ERR("1PPS input not ready!");
+        return -ENODEV;
+    }
+    int ret = gpio_pin_configure_dt(&coord_pps, GPIO_INPUT);
+    if (ret == 0) {
+        ret = gpio_pin_interrupt_configure_dt(&coord_pps, GPIO_INT_EDGE_TO_ACTIVE);
+    }
+    if (ret == 0) {
+        gpio_init_callback(&coord_pps_cb, coord_pps_isr, BIT(coord_pps.pin));
+        ret = gpio_add_callback_dt(&coord_pps, &coord_pps_cb);
+    }
+    return ret;
+}
+
+// Tulostetaan aikakannan tila (SYNC,?)
+static void coord_print(void) {
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    uint64_t timebase_ms = k_ticks_to_ms_near64(MAX(k_uptime_ticks() - coord_epoch_ticks, 0));
+    bool synced = coord_synced;
+    int32_t pps_error_us = coord_pps_error_us;
+    k_spin_unlock(&executor_lock, key);
+
+    printk("Timebase %llu ms (%s), last 1PPS correction %d us\n", (unsigned long long)timebase_ms,
+           synced ? "synced" : "not synced", (int)pps_error_us);
+}
+
+// Ilmaisintulot ovat valinnaisia: puuttuva alias jättää tulon pois käytöstä.
+// Kutsutaan suorittajan ajastimen alustuksen jälkeen.
+static int signal_detectors_init(void) {
+    signal_detectors_present = 0;
+    for (size_t i = 0; i < ARRAY_SIZE(signal_detectors); i++) {
+        const struct gpio_dt_spec *input = &signal_detectors[i];
+
+        if (input->port == NULL) {
+            continue;
+        }
+        if (!gpio_is_ready_dt(input)) {
+            LOG_ERR("Detector %u device not ready!", (unsigned int)i + 1);
+            return -ENODEV;
+        }
+        int ret = gpio_pin_configure_dt(input, GPIO_INPUT);
+        if (ret == 0) {
+            ret = gpio_pin_interrupt_configure_dt(input, GPIO_INT_EDGE_TO_ACTIVE);
+        }
+        if (ret == 0) {
+            gpio_init_callback(&signal_detector_cb[i], signal_detector_isr, BIT(input->pin));
+            ret = gpio_add_callback_dt(input, &signal_detector_cb[i]);
+        }
+        if (ret != 0) {
+            LOG_ERR("Detector %u setup failed: %d", (unsigned int)i + 1, ret);
+            return ret;
+        }
+        signal_detectors_present |= BIT(i);
+    }
+    return 0;
+}
+
+// Katkaistaan ryhmän askel heti ja näytetään väri duration_ms ajan (0 =
+// kunnes !> tai !X). Voidaan kutsua keskeytyksestä.
+static void group_override(struct signal_group *group, const struct signal_color *color, uint32_t duration_ms) {
+    struct executor *exec = &group->executor;
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+    // Vikatilan vilkku on ensisijainen, ohitus vaatii ensin FAULT,0:n
+    if (fault_cause != FAULT_NONE) {
+        k_spin_unlock(&executor_lock, key);
+        LOG_WRN("[%u] Override ignored during fault", group->id);
+        return;
+    }
+#endif
+
+    // Katkaistu askel näytetään jatkettaessa alusta, koko kestonsa ajan
+    if (exec->override_phase == NULL && exec->program != NULL && !exec->waiting) {
+        exec->elapsed_ms -= exec->program->steps[exec->step_index].duration;
+    }
+    exec->waiting = true;
+    exec->cycle_hold = false;
+    exec->override_phase = &group->color_phases[color - signal_colors];
+    exec->override_end_ticks = (duration_ms > 0) ? k_uptime_ticks() + k_ms_to_ticks_ceil64(duration_ms) : INT64_MAX;
+    signal_phase_apply(exec->override_phase, group->id, color->color);
+    executor_reschedule();
+
+    k_spin_unlock(&executor_lock, key);
+}
+
+// Lopetetaan ohitus. discard hylkää aktiivisen ja valmiustilan aikataulut;
+// slotteja on kiinteä määrä, joten askelmäärä ei vaikuta hylkäämisen kestoon.
+// Käännettävänä olevaa riviä ei hylätä, koska sitä ei ole vielä jonossa.
+static void group_override_end(struct signal_group *group, bool discard) {
+    struct executor *exec = &group->executor;
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+    if (fault_cause != FAULT_NONE) {
+        k_spin_unlock(&executor_lock, key);
+        LOG_WRN("[%u] Override ignored during fault", group->id);
+        return;
+    }
+#endif
+
+    // Hylätyt aikataulut raportoidaan keskeytettyinä (ERROR), ei valmiina
+    if (discard) {
+        atomic_set(&group->swap_request, SWAP_NONE);
+        if (exec->program != NULL) {
+            executor_retire(group, true);
+        }
+        for (int i = 0; i < SCHEDULE_SLOTS; i++) {
+            if (group->slots[i].slot_state == SLOT_STANDBY) {
+                group->slots[i].slot_state = SLOT_FREE;
+                atomic_dec(&group->programs_pending);
+                signal_event_post(SIGNAL_EVENT_ERROR, group->id, group->slots[i].upload_seq, 0, 0);
+            }
+        }
+        LOG_INF("[%u] Schedules discarded", group->id);
+        if (exec->override_phase == NULL) {
+            executor_advance(group, false);
+        }
+    }
+    if (exec->override_phase != NULL) {
+        executor_override_finish(group);
+    }
+    executor_reschedule();
+
+    k_spin_unlock(&executor_lock, key);
+}
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+#ifdef CONFIG_TRAFFIC_SIGNALS_WATCHDOG
+static const struct device *const fault_wdt = DEVICE_DT_GET(DT_ALIAS(watchdog0));
+static int fault_wdt_channel = -1;
+#endif
+
+static uint32_t fault_flash_seen;  // Vilkun vaihdot edellisellä valvontakierroksella, vain työjono käyttää
+
+static void fault_monitor_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(fault_monitor_work, fault_monitor_handler);
+
+// Ryhmän vikavaihe: keltainen, punainen tai pimeä
+static const struct signal_phase *fault_phase(const struct signal_group *group) {
+    const struct signal_color *color = signal_group_color(group, 'Y');
+
+    if (color == NULL) {
+        color = signal_group_color(group, 'R');
+    }
+    return (color != NULL) ? &group->color_phases[color - signal_colors] : &group->dark_phase;
+}
+
+// Vikatilaan: jokainen ryhmä pysäytetään kuten ohituksessa ja vilkku
+// käynnistetään. Kutsutaan executor_lockin sisällä, myös keskeytyksestä.
+static void fault_enter(struct signal_group *group, enum fault_cause cause) {
+    fault_count++;
+    if (fault_cause != FAULT_NONE) {
+        return;
+    }
+    fault_cause = cause;
+    fault_group_id = group->id;
+    fault_since_ms = k_uptime_get();
+
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        struct signal_group *other = &signal_groups[g];
+        struct executor *exec = &other->executor;
+
+        if (other->colors_available == 0) {
+            continue;
+        }
+        // Katkaistu askel näytetään kuittauksen jälkeen alusta
+        if (exec->override_phase == NULL && exec->program != NULL && !exec->waiting) {
+            exec->elapsed_ms -= exec->program->steps[exec->step_index].duration;
+        }
+        exec->waiting = true;
+        exec->cycle_hold = false;
+        exec->override_phase = fault_phase(other);
+        exec->override_end_ticks = INT64_MAX;
+    }
+    fault_flash_on = false;
+    k_timer_start(&fault_flash_timer, K_NO_WAIT, K_MSEC(FAULT_FLASH_MS));
+
+    LOG_ERR("[%u] Fault: %s, flashing", group->id, fault_cause_names[cause]);
+    signal_event_post(SIGNAL_EVENT_FAULT, group->id, 0, 0, cause);
+}
+
+static void fault_flash_expiry(struct k_timer *timer) {
+    ARG_UNUSED(timer);
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+
+    fault_flash_on = !fault_flash_on;
+    fault_flash_count++;
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        struct signal_group *group = &signal_groups[g];
+        const struct signal_phase *phase = group->executor.override_phase;
+
+        if (group->colors_available == 0 || phase == NULL) {
+            continue;
+        }
+        if (fault_flash_on && phase != &group->dark_phase) {
+            signal_phase_apply(phase, group->id, signal_colors[phase - group->color_phases].color);
+        } else {
+            signal_phase_apply(&group->dark_phase, group->id, 0);
+        }
+    }
+
+    k_spin_unlock(&executor_lock, key);
+}
+
+// Valvonta työjonossa: myöhästynyt askelraja tarkoittaa, että suorittajan
+// ajastin on jumissa. Vahtikoira ruokitaan vain, kun suorittaja tai
+// vikatilan vilkku etenee; muuten laite käynnistyy uudelleen ja tallennettu
+// aikataulu jatkuu NVS:stä.
+static void fault_monitor_handler(struct k_work *work) {
+    ARG_UNUSED(work);
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    int64_t limit = k_uptime_ticks() - (int64_t)k_ms_to_ticks_ceil64(FAULT_STALL_MS);
+    bool healthy = true;
+
+    if (fault_cause == FAULT_NONE) {
+        for (int g = 0; g < SIGNAL_GROUPS; g++) {
+            struct signal_group *group = &signal_groups[g];
+
+            if (executor_next_deadline(&group->executor) < limit) {
+                fault_enter(group, FAULT_STALL);
+                executor_reschedule();
+                break;
+            }
+        }
+    } else {
+        healthy = fault_flash_count != 0 && fault_flash_count != fault_flash_seen;
+    }
+    fault_flash_seen = fault_flash_count;
+
+    k_spin_unlock(&executor_lock, key);
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_WATCHDOG
+    if (healthy && fault_wdt_channel >= 0) {
+        wdt_feed(fault_wdt, fault_wdt_channel);
+    }
+#else
+    ARG_UNUSED(healthy);
+#endif
+    k_work_reschedule(&fault_monitor_work, K_MSEC(FAULT_MONITOR_PERIOD_MS));
+}
+
+// Kuitataan vika (FAULT,0): vilkku loppuu ja ryhmät jatkavat aikataulujaan.
+// Jos vika on yhä päällä, seuraava askel palauttaa vikatilan.
+static void fault_reset(void) {
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    bool active = fault_cause != FAULT_NONE;
+
+    if (active) {
+        fault_cause = FAULT_NONE;
+        k_timer_stop(&fault_flash_timer);
+        for (int g = 0; g < SIGNAL_GROUPS; g++) {
+            struct signal_group *group = &signal_groups[g];
+            // Jatkettu askel voi palauttaa vikatilan, jolloin loput ryhmät jäävät vilkkumaan
+            if (group->colors_available != 0 && group->executor.override_phase != NULL &&
+                fault_cause == FAULT_NONE) {
+                executor_override_finish(group);
+            }
+        }
+        executor_reschedule();
+    }
+
+    k_spin_unlock(&executor_lock, key);
+    printk(active ? "Fault cleared\n" : "No active fault\n");
+}
+
+// Vikatila (FAULT,?)
+static void fault_print(void) {
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    uint8_t cause = fault_cause;
+    uint8_t group_id = fault_group_id;
+    uint32_t count = fault_count;
+    int64_t since_ms = fault_since_ms;
+    k_spin_unlock(&executor_lock, key);
+
+    if (cause == FAULT_NONE) {
+        printk("No active fault, %u faults since boot\n", count);
+    } else {
+        printk("Fault: %s on group %u for %lld ms, %u faults since boot\n", fault_cause_names[cause], group_id,
+               (long long)(k_uptime_get() - since_ms), count);
+    }
+}
+
+// Kutsutaan suorittajan ajastimen alustuksen jälkeen, ennen tallennetun
+// aikataulun käynnistystä
+static int fault_monitor_init(void) {
+    k_timer_init(&fault_flash_timer, fault_flash_expiry, NULL);
+#ifdef CONFIG_TRAFFIC_SIGNALS_WATCHDOG
+    struct wdt_timeout_cfg cfg = {
+        .window = {.min = 0, .max = CONFIG_TRAFFIC_SIGNALS_WATCHDOG_TIMEOUT_MS},
+        .flags = WDT_FLAG_RESET_SOC,
+    };
+
+    if (!device_is_ready(fault_wdt)) {
+        return -ENODEV;
+    }
+    fault_wdt_channel = wdt_install_timeout(fault_wdt, &cfg);
+    if (fault_wdt_channel < 0) {
+        return fault_wdt_channel;
+    }
+    int ret = wdt_setup(fault_wdt, WDT_OPT_PAUSE_HALTED_BY_DBG);
+    if (ret != 0) {
+        fault_wdt_channel = -1;
+        return ret;
+    }
+#endif
+    k_work_reschedule(&fault_monitor_work, K_MSEC(FAULT_MONITOR_PERIOD_MS));
+    return 0;
+}
+#else
+static void fault_reset(void) {
+    printk("Fault monitor disabled (CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR)\n");
+}
+
+static void fault_print(void) {
+    printk("Fault monitor disabled (CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR)\n");
+}
+#endif /* CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR */
+#else /* CONFIG_TRAFFIC_SIGNALS_NETCORE */
+// Verkkoytimellä ei ole LEDejä eikä suorittajaa. Ryhmä on pelkkä osoite
+// ja käännöspuskuri; valmis ohjelma lähetetään sovellusytimelle, joka
+// tarkistaa ryhmän värit.
+struct signal_group {
+    uint8_t id;
+    atomic_t programs_pending;  // Aina 0, joten käännös ei odota suoritusta
+    struct sequence_program program;
+};
+
+static struct signal_group signal_groups[SIGNAL_GROUPS];
+
+static const struct signal_color *signal_group_color(const struct signal_group *group, char color) {
+    ARG_UNUSED(group);
+    return find_signal_color(color);
+}
+
+static int signal_groups_init(void) {
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        signal_groups[g].id = g + 1;
+        signal_groups[g].program.group = &signal_groups[g];
+    }
+    return 0;
+}
+
+static struct signal_group *find_signal_group(unsigned int id) {
+    if (id < 1 || id > SIGNAL_GROUPS) {
+        return NULL;
+    }
+    return &signal_groups[id - 1];
+}
+#endif /* CONFIG_TRAFFIC_SIGNALS_NETCORE */
+
+// Sekvenssijäsentimen virhekoodit
+enum seq_parse_error {
+    SEQ_ERR_NONE = 0,
+    SEQ_ERR_EXPECTED_COLOR,      // Odotettiin värikirjainta tai 'T'
+    SEQ_ERR_EXPECTED_COMMA,      // Värin jälkeen puuttuu pilkku
+    SEQ_ERR_EXPECTED_NUMBER,     // Pilkun jälkeen puuttuu luku
+    SEQ_ERR_EXPECTED_SEPARATOR,  // Luvun perässä muu kuin pilkku tai välilyönti
+    SEQ_ERR_NUMBER_RANGE,        // Luku on liian suuri
+    SEQ_ERR_REPEAT_RANGE,        // Toistomäärä ei ole välillä 1..MAX_REPEAT_TIMES
+    SEQ_ERR_TRAILING_INPUT,      // 'T,n' ei ollut viimeinen komento
+    SEQ_ERR_UNKNOWN_COLOR,       // Värille ei ole käsittelijää
+    SEQ_ERR_TOO_MANY_STEPS,      // Askeltaulukko on täynnä
+    SEQ_ERR_EXPECTED_DETECTOR,   // Maksimikeston perästä puuttuu '@n'
+    SEQ_ERR_MAX_RANGE,           // Maksimikesto on minimiä pienempi
+    SEQ_ERR_UNKNOWN_DETECTOR,    // Ilmaisintuloa ei ole
+    SEQ_ERR_CYCLE_RANGE,         // Askeleet eivät mahdu kiertoon 'C'
+    SEQ_ERR_OFFSET_RANGE,        // Siirto ei ole kiertoa pienempi
+    SEQ_ERR_LINE_TOO_LONG,       // Rivi ei mahtunut vastaanottopuskuriin
+    SEQ_ERR_REPLACED,            // Valmiustilan aikataulu korvattiin uudella
+};
+
+// Virhekoodien kuvaukset tulostusta varten
+static const char *const seq_parse_error_names[] = {
+    [SEQ_ERR_NONE] = "no error",
+    [SEQ_ERR_EXPECTED_COLOR] = "expected color",
+    [SEQ_ERR_EXPECTED_COMMA] = "expected ','",
+    [SEQ_ERR_EXPECTED_NUMBER] = "expected number",
+    [SEQ_ERR_EXPECTED_SEPARATOR] = "expected separator",
+    [SEQ_ERR_NUMBER_RANGE] = "number out of range",
+    [SEQ_ERR_REPEAT_RANGE] = "repeat count out of range",
+    [SEQ_ERR_TRAILING_INPUT] = "input after repeat",
+    [SEQ_ERR_UNKNOWN_COLOR] = "unknown color",
+    [SEQ_ERR_TOO_MANY_STEPS] = "too many steps",
+    [SEQ_ERR_EXPECTED_DETECTOR] = "expected '@' and detector",
+    [SEQ_ERR_MAX_RANGE] = "maximum below minimum",
+    [SEQ_ERR_UNKNOWN_DETECTOR] = "unknown detector",
+    [SEQ_ERR_CYCLE_RANGE] = "steps longer than cycle",
+    [SEQ_ERR_OFFSET_RANGE] = "offset not below cycle",
+    [SEQ_ERR_LINE_TOO_LONG] = "line too long",
+    [SEQ_ERR_REPLACED] = "replaced in standby",
+};
+
+enum seq_token_type {
+    SEQ_TOKEN_NONE,    // Merkki kulutettu, token ei vielä valmis
+    SEQ_TOKEN_STEP,    // Askel: color, value (kesto ms), max_value ja detector
+    SEQ_TOKEN_REPEAT,  // Toisto: value (toistomäärä)
+    SEQ_TOKEN_CYCLE,   // Koordinoitu kierto: value (pituus ms) ja max_value (siirto ms)
+    SEQ_TOKEN_ERROR,   // Virhe: error ja column
+};
+
+struct seq_token {
+    enum seq_token_type type;
+    char color;
+    uint32_t value;
+    uint32_t max_value;
+    uint8_t detector;
+    uint16_t column;  // Tokenin (tai virheen) sarake riviltä, alkaen 1:stä
+    enum seq_parse_error error;
+};
+
+enum seq_parser_state {
+    SEQ_STATE_COLOR,         // Odotetaan väriä tai 'T'
+    SEQ_STATE_COMMA,         // Odotetaan pilkkua värin jälkeen
+    SEQ_STATE_NUMBER_START,  // Odotetaan luvun ensimmäistä numeroa
+    SEQ_STATE_NUMBER,        // Luetaan lukua
+    SEQ_STATE_DONE,          // 'T,n' luettu, vain erottimia sallitaan
+    SEQ_STATE_ERROR,         // Virhe raportoitu, loput merkit ohitetaan
+};
+
+// Askeleen luvut: kesto, ilmaisinaskeleella myös '/max' ja '@tulo'
+enum seq_number_field {
+    SEQ_FIELD_VALUE,
+    SEQ_FIELD_MAX,
+    SEQ_FIELD_DETECTOR,
+    SEQ_FIELD_OFFSET,  // 'C,kierto,siirto'
+};
+
+// Merkki kerrallaan etenevä jäsennin muotoa "R,1000,G,500,T,2" olevalle
+// syötteelle. Ei käytä globaaleja, joten sitä voi syöttää mistä tahansa
+// siirtotiestä, ja askeleet saadaan ulos heti kun ne on luettu.
+struct seq_parser {
+    enum seq_parser_state state;
+    enum seq_number_field field;  // Luettava luku
+    char color;
+    uint32_t numbers[4];          // enum seq_number_field -indeksein
+    uint16_t column;
+    uint16_t token_column;
+};
+
+void seq_parser_init(struct seq_parser *parser) {
+    parser->state = SEQ_STATE_COLOR;
+    parser->field = SEQ_FIELD_VALUE;
+    parser->color = 0;
+    memset(parser->numbers, 0, sizeof(parser->numbers));
+    parser->column = 0;
+    parser->token_column = 0;
+}
+
+static enum seq_token_type seq_parser_error(struct seq_parser *parser, enum seq_parse_error error,
+                                            struct seq_token *token) {
+    parser->state = SEQ_STATE_ERROR;
+    token->type = SEQ_TOKEN_ERROR;
+    token->error = error;
+    token->column = parser->column;
+    return SEQ_TOKEN_ERROR;
+}
+
+// Luettu luku valmis: tehdään siitä askel tai toisto
+static enum seq_token_type seq_parser_emit(struct seq_parser *parser, struct seq_token *token) {
+    uint32_t value = parser->numbers[SEQ_FIELD_VALUE];
+
+    if (parser->field == SEQ_FIELD_MAX) {
+        return seq_parser_error(parser, SEQ_ERR_EXPECTED_DETECTOR, token);
+    }
+
+    token->column = parser->token_column;
+    token->value = value;
+    token->error = SEQ_ERR_NONE;
+
+    if (parser->color == 'C') {
+        if (parser->field != SEQ_FIELD_OFFSET) {
+            parser->column++;
+            return seq_parser_error(parser, SEQ_ERR_EXPECTED_NUMBER, token);
+        }
+        parser->state = SEQ_STATE_COLOR;
+        parser->field = SEQ_FIELD_VALUE;
+        token->type = SEQ_TOKEN_CYCLE;
+        token->max_value = parser->numbers[SEQ_FIELD_OFFSET];
+        return SEQ_TOKEN_CYCLE;
+    }
+
+    if (parser->color == 'T') {
+        if (value < 1 || value > MAX_REPEAT_TIMES) {
+            parser->column = parser->token_column;
+            return seq_parser_error(parser, SEQ_ERR_REPEAT_RANGE, token);
+        }
+        parser->state = SEQ_STATE_DONE;
+        token->type = SEQ_TOKEN_REPEAT;
+        return SEQ_TOKEN_REPEAT;
+    }
+
+    bool adaptive = parser->field == SEQ_FIELD_DETECTOR;
+    token->max_value = adaptive ? parser->numbers[SEQ_FIELD_MAX] : value;
+    token->detector = adaptive ? MIN(parser->numbers[SEQ_FIELD_DETECTOR], UINT8_MAX) : 0;
+
+    parser->state = SEQ_STATE_COLOR;
+    parser->field = SEQ_FIELD_VALUE;
+    token->type = SEQ_TOKEN_STEP;
+    token->color = parser->color;
+    return SEQ_TOKEN_STEP;
+}
+
+// Syötetään yksi merkki. Palauttaa SEQ_TOKEN_NONE, kunnes askel, toisto
+// tai virhe on valmis; silloin se on kirjoitettu *token-rakenteeseen.
+enum seq_token_type seq_parser_feed(struct seq_parser *parser, char c, struct seq_token *token) {
+    parser->column++;
+
+    switch (parser->state) {
+        case SEQ_STATE_COLOR:
+            if (c == ',' || c == ' ') {
+                return SEQ_TOKEN_NONE;  // Ylimääräiset erottimet ohitetaan
+            }
+            if (c < 'A' || c > 'Z') {
+                return seq_parser_error(parser, SEQ_ERR_EXPECTED_COLOR, token);
+            }
+            parser->color = c;
+            parser->token_column = parser->column;
+            parser->state = SEQ_STATE_COMMA;
+            return SEQ_TOKEN_NONE;
+
+        case SEQ_STATE_COMMA:
+            if (c != ',') {
+                return seq_parser_error(parser, SEQ_ERR_EXPECTED_COMMA, token);
+            }
+            parser->state = SEQ_STATE_NUMBER_START;
+            return SEQ_TOKEN_NONE;
+
+        case SEQ_STATE_NUMBER_START:
+            if (c == ' ') {
+                return SEQ_TOKEN_NONE;
+            }
+            if (c < '0' || c > '9') {
+                return seq_parser_error(parser, SEQ_ERR_EXPECTED_NUMBER, token);
+            }
+            parser->numbers[parser->field] = c - '0';
+            parser->state = SEQ_STATE_NUMBER;
+            return SEQ_TOKEN_NONE;
+
+        case SEQ_STATE_NUMBER:
+            if (c >= '0' && c <= '9') {
+                uint32_t *number = &parser->numbers[parser->field];
+                if (*number > (UINT32_MAX - 9) / 10) {
+                    return seq_parser_error(parser, SEQ_ERR_NUMBER_RANGE, token);
+                }
+                *number = *number * 10 + (c - '0');
+                return SEQ_TOKEN_NONE;
+            }
+            // Kierron pituuden perään siirto
+            if (c == ',' && parser->color == 'C' && parser->field == SEQ_FIELD_VALUE) {
+                parser->field = SEQ_FIELD_OFFSET;
+                parser->state = SEQ_STATE_NUMBER_START;
+                return SEQ_TOKEN_NONE;
+            }
+            // Ilmaisinaskel: minimin perään '/max', sen perään '@tulo'
+            if (c == '/' && parser->field == SEQ_FIELD_VALUE && parser->color != 'T' && parser->color != 'C') {
+                parser->field = SEQ_FIELD_MAX;
+                parser->state = SEQ_STATE_NUMBER_START;
+                return SEQ_TOKEN_NONE;
+            }
+            if (c == '@' && parser->field == SEQ_FIELD_MAX) {
+                parser->field = SEQ_FIELD_DETECTOR;
+                parser->state = SEQ_STATE_NUMBER_START;
+                return SEQ_TOKEN_NONE;
+            }
+            if (parser->field == SEQ_FIELD_MAX) {
+                return seq_parser_error(parser, SEQ_ERR_EXPECTED_DETECTOR, token);
+            }
+            if (c != ',' && c != ' ') {
+                return seq_parser_error(parser, SEQ_ERR_EXPECTED_SEPARATOR, token);
+            }
+            return seq_parser_emit(parser, token);
+
+        case SEQ_STATE_DONE:
+            if (c == ',' || c == ' ') {
+                return SEQ_TOKEN_NONE;
+            }
+            return seq_parser_error(parser, SEQ_ERR_TRAILING_INPUT, token);
+
+        case SEQ_STATE_ERROR:
+        default:
+            return SEQ_TOKEN_NONE;
+    }
+}
+
+// Syötteen loppu: palauttaa viimeisen kesken olleen askeleen tai virheen
+enum seq_token_type seq_parser_finish(struct seq_parser *parser, struct seq_token *token) {
+    switch (parser->state) {
+        case SEQ_STATE_NUMBER:
+            return seq_parser_emit(parser, token);
+        case SEQ_STATE_COMMA:
+            parser->column++;
+            return seq_parser_error(parser, SEQ_ERR_EXPECTED_COMMA, token);
+        case SEQ_STATE_NUMBER_START:
+            parser->column++;
+            return seq_parser_error(parser, SEQ_ERR_EXPECTED_NUMBER, token);
+        default:
+            return SEQ_TOKEN_NONE;
+    }
+}
+
+// Lisätään jäsentimen token ohjelmaan
+static enum seq_parse_error program_add_token(struct sequence_program *program, const struct seq_token *token) {
+    switch (token->type) {
+        case SEQ_TOKEN_STEP:
+            if (signal_group_color(program->group, token->color) == NULL) {
+                return SEQ_ERR_UNKNOWN_COLOR;
+            }
+            if (token->max_value < token->value) {
+                return SEQ_ERR_MAX_RANGE;
+            }
+            if (token->detector != 0 && !signal_detector_available(token->detector)) {
+                return SEQ_ERR_UNKNOWN_DETECTOR;
+            }
+            if (program->step_count >= MAX_PROGRAM_STEPS) {
+                return SEQ_ERR_TOO_MANY_STEPS;
+            }
+            program->max_total_ms += token->max_value;
+            if (program->cycle_ms != 0 && program->max_total_ms > program->cycle_ms) {
+                return SEQ_ERR_CYCLE_RANGE;
+            }
+            LOG_DBG("Color: %c, Duration: %u ms", token->color, token->value);
+            program->steps[program->step_count].color = token->color;
+            program->steps[program->step_count].duration = token->value;
+            program->steps[program->step_count].max_duration = token->max_value;
+            program->steps[program->step_count].detector = token->detector;
+            program->step_count++;
+            return SEQ_ERR_NONE;
+        case SEQ_TOKEN_REPEAT:
+            program->repeat_times = token->value;
+            return SEQ_ERR_NONE;
+        case SEQ_TOKEN_CYCLE:
+            if (token->value == 0 || program->max_total_ms > token->value) {
+                return SEQ_ERR_CYCLE_RANGE;
+            }
+            if (token->max_value >= token->value) {
+                return SEQ_ERR_OFFSET_RANGE;
+            }
+            program->cycle_ms = token->value;
+            program->offset_ms = token->max_value;
+            return SEQ_ERR_NONE;
+        case SEQ_TOKEN_ERROR:
+            return token->error;
+        default:
+            return SEQ_ERR_NONE;
+    }
+}
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+// Siirretään ohjelma valmiustilaan suorittajalle (kerran per ohjelma)
+static void program_enqueue(struct sequence_program *program) {
+    struct signal_group *group = program->group;
+
+    if (!program->queued) {
+        program->queued = true;
+        program->dispatch_cycles = k_cycle_get_32();
+        metrics_hwm(&metrics.programs_hwm, atomic_inc(&group->programs_pending) + 1);
+
+        k_spinlock_key_t key = k_spin_lock(&executor_lock);
+        program->upload_seq = ++group->upload_seq;
+        program->slot_state = SLOT_STANDBY;
+        k_spin_unlock(&executor_lock, key);
+    }
+}
+
+// Vapautetaan slotti, jota suorittaja ei koskaan saanut
+static void program_release(struct sequence_program *program) {
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    program->slot_state = SLOT_FREE;
+    k_spin_unlock(&executor_lock, key);
+}
+
+// Julkaistaan käännetyt askeleet suorittajalle
+static void program_publish(struct sequence_program *program) {
+    atomic_set(&program->ready_steps, program->step_count);
+    program_enqueue(program);
+    executor_kick(program->group);
+}
+
+// Kääntäminen päättyi. Virheellinen tai tyhjä ohjelma, jota suorittaja ei
+// vielä ole saanut, vapautetaan heti; muuten suorittaja vapauttaa sen.
+static void program_close(struct sequence_program *program, bool valid) {
+    struct signal_group *group = program->group;
+    bool keep = valid && program->step_count > 0;
+    bool queued = program->queued;
+
+    if (!keep && !queued) {
+        if (!valid) {
+            signal_event_post(SIGNAL_EVENT_ERROR, group->id, 0, 0, program->error);
+        }
+        program_release(program);
+        return;
+    }
+
+    // Jos suorittaja jo omistaa ohjelman, siihen ei kosketa tilan asettamisen jälkeen
+    atomic_set(&program->ready_steps, program->step_count);
+    atomic_set(&program->state, keep ? PROGRAM_CLOSED : PROGRAM_ABORTED);
+    if (!queued) {
+        program_enqueue(program);
+    }
+    executor_kick(group);
+    if (keep) {
+        // Käännöksen aikana käynnistynyt aikataulu voidaan tallentaa vasta nyt
+        k_work_submit(&schedule_persist_work);
+    }
+}
+#endif /* !CONFIG_TRAFFIC_SIGNALS_NETCORE */
+
+// Alustetaan tyhjä, avoin ohjelma
+static void program_init(struct sequence_program *program) {
+    program->step_count = 0;
+    program->repeat_times = 1;
+    program->cycle_ms = 0;
+    program->offset_ms = 0;
+    program->max_total_ms = 0;
+    program->queued = false;
+    program->error = 0;
+    atomic_set(&program->ready_steps, 0);
+    atomic_set(&program->state, PROGRAM_OPEN);
+}
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+// Varataan ryhmältä slotti uudelle aikataululle. Ensisijaisesti vapaa
+// slotti, muuten korvataan uusin valmiustilassa odottava aikataulu, josta
+// ilmoitetaan ERROR-tapahtumalla, jotta isäntä tietää sen kadonneen.
+static struct sequence_program *program_alloc(struct signal_group *group) {
+    struct sequence_program *program = NULL;
+    struct sequence_program *newest = NULL;
+    bool replaced = false;
+    uint32_t replaced_seq = 0;
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+
+    for (int i = 0; i < SCHEDULE_SLOTS && program == NULL; i++) {
+        struct sequence_program *slot = &group->slots[i];
+        if (slot->slot_state == SLOT_FREE) {
+            program = slot;
+        } else if (slot->slot_state == SLOT_STANDBY &&
+                   (newest == NULL || (int32_t)(slot->upload_seq - newest->upload_seq) > 0)) {
+            newest = slot;
+        }
+    }
+    if (program == NULL && newest != NULL) {
+        program = newest;
+        replaced = true;
+        replaced_seq = newest->upload_seq;
+        atomic_dec(&group->programs_pending);
+    }
+    if (program != NULL) {
+        program->slot_state = SLOT_LOADING;
+    }
+
+    k_spin_unlock(&executor_lock, key);
+
+    if (program == NULL) {
+        LOG_ERR("No free schedule slot, sequence dropped");
+        return NULL;
+    }
+    if (replaced) {
+        LOG_WRN("[%u] Standby schedule %u replaced", group->id, replaced_seq);
+        signal_event_post(SIGNAL_EVENT_ERROR, group->id, replaced_seq, 0, SEQ_ERR_REPLACED);
+    }
+    metrics_count(&metrics.program_allocs, 1);
+    program_init(program);
+    return program;
+}
+#endif /* !CONFIG_TRAFFIC_SIGNALS_NETCORE */
+
+// Aikataulun tallennusmuoto: otsake ja käännetyt askeleet sellaisinaan,
+// joten palautus ei jäsennä mitään. Tallennetaan vain käytetyt askeleet.
+struct schedule_record {
+    uint8_t version;
+    uint16_t step_count;
+    uint16_t repeat_times;
+    uint32_t cycle_ms;
+    uint32_t offset_ms;
+    struct sequence_step steps[MAX_PROGRAM_STEPS];
+} __packed;
+
+#define SCHEDULE_RECORD_HEADER_LEN offsetof(struct schedule_record, steps)
+
+// Slotit ja tallennuspuskuri ovat staattisia, joten liian suuri
+// askelmäärä huomataan jo käännöksessä eikä vasta linkityksessä.
+// Pinoille, jonoille ja ytimelle jätetään RAM_RESERVE_BYTES.
+#define RAM_RESERVE_BYTES (64 * 1024)
+#if DT_HAS_CHOSEN(zephyr_sram)
+BUILD_ASSERT(sizeof(signal_groups) + sizeof(struct schedule_record) + RAM_RESERVE_BYTES <=
+                 DT_REG_SIZE(DT_CHOSEN(zephyr_sram)),
+             "Schedule slots do not fit in RAM: lower CONFIG_TRAFFIC_SIGNALS_MAX_STEPS, "
+             "CONFIG_TRAFFIC_SIGNALS_GROUPS or CONFIG_TRAFFIC_SIGNALS_SCHEDULE_SLOTS");
+#endif
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+
+static struct nvs_fs schedule_fs;
+static bool schedule_storage_ready;
+static struct schedule_record schedule_record;  // Vain työjono ja main käyttävät
+
+// Tallennetaan ryhmän suorituksessa oleva aikataulu, kun sen kääntäminen on valmis.
+// NVS ei kirjoita flashiin, jos sama aikataulu on jo tallennettuna.
+// Lukon alla otetaan vain otsake: suljetun ohjelman askeleet eivät enää
+// muutu, joten ne kopioidaan lukon ulkopuolella, eikä kopio viivästytä
+// suorittajan ajastinta. Jos slotti ehdittiin sillä välin vaihtaa,
+// kopio hylätään; uuden ohjelman käynnistys tallentaa sen.
+static void schedule_persist_group(struct signal_group *group) {
+    struct sequence_program *program;
+    uint32_t upload_seq = 0;
+    uint16_t step_count = 0;
+
+    k_spinlock_key_t key = k_spin_lock(&executor_lock);
+    program = group->executor.program;
+    if (program != NULL && atomic_get(&program->state) == PROGRAM_CLOSED &&
+        program->upload_seq != group->persisted_seq) {
+        upload_seq = program->upload_seq;
+        step_count = atomic_get(&program->ready_steps);
+        schedule_record.version = SCHEDULE_RECORD_VERSION;
+        schedule_record.step_count = step_count;
+        schedule_record.repeat_times = program->repeat_times;
+        schedule_record.cycle_ms = program->cycle_ms;
+        schedule_record.offset_ms = program->offset_ms;
+    } else {
+        program = NULL;
+    }
+    k_spin_unlock(&executor_lock, key);
+
+    if (program == NULL) {
+        return;
+    }
+
+    memcpy(schedule_record.steps, program->steps, step_count * sizeof(struct sequence_step));
+
+    key = k_spin_lock(&executor_lock);
+    bool unchanged = group->executor.program == program && program->upload_seq == upload_seq;
+    k_spin_unlock(&executor_lock, key);
+    if (!unchanged) {
+        return;
+    }
+
+    size_t len = SCHEDULE_RECORD_HEADER_LEN + step_count * sizeof(struct sequence_step);
+    ssize_t ret = nvs_write(&schedule_fs, SCHEDULE_NVS_ID + group->id - 1, &schedule_record, len);
+    if (ret < 0) {
+        // persisted_seq jää ennalleen, joten seuraava tallennus yrittää uudelleen
+        LOG_ERR("[%u] Schedule save failed: %d", group->id, (int)ret);
+        return;
+    }
+    group->persisted_seq = upload_seq;
+    LOG_DBG("[%u] Schedule saved, %u steps", group->id, step_count);
+}
+
+static void schedule_persist_handler(struct k_work *work) {
+    ARG_UNUSED(work);
+
+    if (!schedule_storage_ready) {
+        return;
+    }
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        schedule_persist_group(&signal_groups[g]);
+    }
+}
+
+// Liitetään NVS storage_partitionin alkuun
+static int schedule_storage_init(void) {
+    struct flash_pages_info info;
+
+    k_work_init(&schedule_persist_work, schedule_persist_handler);
+
+    schedule_fs.flash_device = FIXED_PARTITION_DEVICE(storage_partition);
+    if (!device_is_ready(schedule_fs.flash_device)) {
+        return -ENODEV;
+    }
+    schedule_fs.offset = FIXED_PARTITION_OFFSET(storage_partition);
+    int ret = flash_get_page_info_by_offs(schedule_fs.flash_device, schedule_fs.offset, &info);
+    if (ret != 0) {
+        return ret;
+    }
+    schedule_fs.sector_size = info.size;
+    schedule_fs.sector_count = SCHEDULE_NVS_SECTORS;
+
+    ret = nvs_mount(&schedule_fs);
+    if (ret != 0) {
+        return ret;
+    }
+    schedule_storage_ready = true;
+    return 0;
+}
+
+// Tarkistetaan tallennettu tai vastaanotettu aikataulu ryhmää vasten
+static bool schedule_record_valid(const struct signal_group *group, const struct schedule_record *record,
+                                  size_t len) {
+    uint16_t step_count = record->step_count;
+
+    if (len < SCHEDULE_RECORD_HEADER_LEN || record->version != SCHEDULE_RECORD_VERSION ||
+        step_count == 0 || step_count > MAX_PROGRAM_STEPS ||
+        len != SCHEDULE_RECORD_HEADER_LEN + step_count * sizeof(struct sequence_step) ||
+        record->repeat_times < 1 || record->repeat_times > MAX_REPEAT_TIMES ||
+        (record->cycle_ms != 0 && record->offset_ms >= record->cycle_ms)) {
+        return false;
+    }
+    uint64_t max_total_ms = 0;
+    for (int i = 0; i < step_count; i++) {
+        const struct sequence_step *step = &record->steps[i];
+        if (signal_group_color(group, step->color) == NULL || step->max_duration < step->duration ||
+            (step->detector != 0 && !signal_detector_available(step->detector))) {
+            return false;
+        }
+        max_total_ms += step->max_duration;
+    }
+    if (record->cycle_ms != 0 && max_total_ms > record->cycle_ms) {
+        return false;
+    }
+    return true;
+}
+
+// Viedään valmis askeltaulukko ryhmän slottiin ilman jäsennystä
+static int schedule_record_start(struct signal_group *group, const struct schedule_record *record) {
+    struct sequence_program *program = program_alloc(group);
+    if (program == NULL) {
+        return -ENOMEM;
+    }
+    memcpy(program->steps, record->steps, record->step_count * sizeof(struct sequence_step));
+    program->step_count = record->step_count;
+    program->repeat_times = record->repeat_times;
+    program->cycle_ms = record->cycle_ms;
+    program->offset_ms = record->offset_ms;
+    program_close(program, true);
+    return 0;
+}
+
+// Käynnistetään ryhmän viimeksi tallennettu aikataulu suoraan askeltaulukosta
+static void schedule_restore_group(struct signal_group *group) {
+    ssize_t len = nvs_read(&schedule_fs, SCHEDULE_NVS_ID + group->id - 1, &schedule_record,
+                           sizeof(schedule_record));
+    if (len <= 0) {
+        LOG_INF("[%u] No saved schedule", group->id);
+        return;
+    }
+    if (!schedule_record_valid(group, &schedule_record, len)) {
+        LOG_WRN("[%u] Saved schedule is invalid, ignored", group->id);
+        return;
+    }
+    if (schedule_record_start(group, &schedule_record) == 0) {
+        LOG_INF("[%u] Saved schedule resumed, %u steps", group->id, schedule_record.step_count);
+    }
+}
+
+static void schedule_restore(void) {
+    if (!schedule_storage_ready) {
+        return;
+    }
+    for (int g = 1; g <= SIGNAL_GROUPS; g++) {
+        struct signal_group *group = find_signal_group(g);
+        if (group != NULL) {
+            schedule_restore_group(group);
+        }
+    }
+}
+#endif /* !CONFIG_TRAFFIC_SIGNALS_NETCORE */
+
+#if defined(CONFIG_TRAFFIC_SIGNALS_NETCORE) || defined(CONFIG_TRAFFIC_SIGNALS_INTAKE_REMOTE)
+// Ytimien välinen yhteys (IPC service, ipc0). Verkkoydin vastaanottaa ja
+// kääntää sarjaportin rivit ja lähettää valmiit askeltaulukot
+// sovellusytimelle, jossa suoritetaan vain ajoituskriittinen GPIO-työ.
+// Viesti kirjoitetaan suoraan jaetun muistin lähetyspuskuriin, ja
+// vastaanottaja kopioi sen suoraan ryhmän slottiin.
+enum intake_msg_type {
+    INTAKE_MSG_PROGRAM = 1,  // Käännetty aikataulu, schedule_record
+    INTAKE_MSG_SWAP,         // SWAP-pyyntö, swap-kenttä
+    INTAKE_MSG_OVERRIDE,     // Ohituskomento, override-kentät
+    INTAKE_MSG_SYNC,         // Aikakanta lähetyshetkellä, timebase_ms
+    INTAKE_MSG_FAULT_RESET,  // Vian kuittaus FAULT,0
+};
+
+struct intake_msg {
+    uint8_t type;      // enum intake_msg_type
+    uint8_t group_id;
+    uint8_t swap;      // enum swap_request
+    uint8_t override;  // enum override_action
+    char override_color;
+    uint32_t override_ms;
+    uint64_t timebase_ms;
+    struct schedule_record record;  // Vain käytetyt askeleet lähetetään
+} __packed;
+
+#define INTAKE_MSG_HEADER_LEN offsetof(struct intake_msg, record)
+#define INTAKE_MSG_PROGRAM_LEN(steps) \
+    (INTAKE_MSG_HEADER_LEN + SCHEDULE_RECORD_HEADER_LEN + (steps) * sizeof(struct sequence_step))
+
+// Täysi aikataulu on yksi viesti, joten sen on mahduttava yhteen IPC-puskuriin
+BUILD_ASSERT(INTAKE_MSG_PROGRAM_LEN(MAX_PROGRAM_STEPS) <= CONFIG_TRAFFIC_SIGNALS_IPC_BUFFER_SIZE,
+             "CONFIG_TRAFFIC_SIGNALS_MAX_STEPS does not fit in CONFIG_TRAFFIC_SIGNALS_IPC_BUFFER_SIZE");
+
+static struct ipc_ept intake_ept;
+static K_SEM_DEFINE(intake_bound_sem, 0, 1);
+
+static void intake_ept_bound(void *priv) {
+    ARG_UNUSED(priv);
+    k_sem_give(&intake_bound_sem);
+}
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_INTAKE_REMOTE
+// Verkkoytimen viesti, ajetaan IPC-taustan työjonossa
+static void intake_ept_received(const void *data, size_t len, void *priv) {
+    ARG_UNUSED(priv);
+    const struct intake_msg *msg = data;
+
+    if (len < INTAKE_MSG_HEADER_LEN) {
+        return;
+    }
+    struct signal_group *group = find_signal_group(msg->group_id);
+    if (group == NULL) {
+        LOG_WRN("IPC: unknown signal group %u", msg->group_id);
+        return;
+    }
+    if (msg->swap > SWAP_CYCLE || msg->override > OVERRIDE_DISCARD) {
+        LOG_WRN("[%u] IPC: invalid message rejected", group->id);
+        return;
+    }
+
+    if (msg->type == INTAKE_MSG_SWAP) {
+        group_request_swap(group, msg->swap);
+    } else if (msg->type == INTAKE_MSG_SYNC) {
+        coord_sync(msg->timebase_ms, k_uptime_ticks());
+    } else if (msg->type == INTAKE_MSG_FAULT_RESET) {
+        fault_reset();
+    } else if (msg->type == INTAKE_MSG_OVERRIDE) {
+        if (msg->override != OVERRIDE_START) {
+            group_override_end(group, msg->override == OVERRIDE_DISCARD);
+            return;
+        }
+        const struct signal_color *color = signal_group_color(group, msg->override_color);
+        if (color != NULL && msg->override_ms <= MAX_OVERRIDE_MS) {
+            group_override(group, color, msg->override_ms);
+        }
+    } else if (msg->type == INTAKE_MSG_PROGRAM) {
+        if (!schedule_record_valid(group, &msg->record, len - INTAKE_MSG_HEADER_LEN)) {
+            LOG_WRN("[%u] IPC: invalid schedule rejected", group->id);
+            return;
+        }
+        schedule_record_start(group, &msg->record);
+    }
+}
+#else
+static void intake_ept_received(const void *data, size_t len, void *priv) {
+    ARG_UNUSED(data);
+    ARG_UNUSED(len);
+    ARG_UNUSED(priv);
+}
+
+// Varataan len tavun viesti jaetusta muistista; odotetaan, jos kaikki
+// puskurit ovat käytössä. Ohjausviesteille riittää otsake.
+static struct intake_msg *intake_msg_alloc(uint8_t type, const struct signal_group *group, size_t len) {
+    struct intake_msg *msg;
+    uint32_t size = len;
+
+    int ret = ipc_service_get_tx_buffer(&intake_ept, (void **)&msg, &size, K_FOREVER);
+    if (ret < 0) {
+        LOG_ERR("IPC: no TX buffer for %u bytes: %d", (unsigned int)len, ret);
+        return NULL;
+    }
+    msg->type = type;
+    msg->group_id = group->id;
+    msg->swap = SWAP_NONE;
+    msg->override = OVERRIDE_START;
+    msg->override_color = 0;
+    msg->override_ms = 0;
+    msg->timebase_ms = 0;
+    return msg;
+}
+
+static void intake_msg_send(struct intake_msg *msg, size_t len) {
+    int ret = ipc_service_send_nocopy(&intake_ept, msg, len);
+    if (ret < 0) {
+        LOG_ERR("IPC: send failed: %d", ret);
+    }
+}
+
+// Verkkoytimellä ohjelma lähetetään kokonaisena program_closessa
+static void program_publish(struct sequence_program *program) {
+    ARG_UNUSED(program);
+}
+
+static struct sequence_program *program_alloc(struct signal_group *group) {
+    program_init(&group->program);
+    return &group->program;
+}
+
+static void program_close(struct sequence_program *program, bool valid) {
+    if (!valid) {
+        signal_event_post(SIGNAL_EVENT_ERROR, program->group->id, 0, 0, program->error);
+    }
+    if (!valid || program->step_count == 0) {
+        return;
+    }
+
+    size_t len = INTAKE_MSG_PROGRAM_LEN(program->step_count);
+    struct intake_msg *msg = intake_msg_alloc(INTAKE_MSG_PROGRAM, program->group, len);
+    if (msg == NULL) {
+        return;
+    }
+    msg->record.version = SCHEDULE_RECORD_VERSION;
+    msg->record.step_count = program->step_count;
+    msg->record.repeat_times = program->repeat_times;
+    msg->record.cycle_ms = program->cycle_ms;
+    msg->record.offset_ms = program->offset_ms;
+    memcpy(msg->record.steps, program->steps, program->step_count * sizeof(struct sequence_step));
+    intake_msg_send(msg, len);
+}
 
-// Määrittele säikeiden pinot ja ohjauslohkot
-K_THREAD_STACK_DEFINE(uart_receive_stack, STACK_SIZE);
-K_THREAD_STACK_DEFINE(dispatcher_stack, STACK_SIZE);
-K_THREAD_STACK_DEFINE(red_task_stack, STACK_SIZE);
-K_THREAD_STACK_DEFINE(yellow_task_stack, STACK_SIZE);
-K_THREAD_STACK_DEFINE(green_task_stack, STACK_SIZE);
+static void group_request_swap(struct signal_group *group, enum swap_request request) {
+    struct intake_msg *msg = intake_msg_alloc(INTAKE_MSG_SWAP, group, INTAKE_MSG_HEADER_LEN);
+    if (msg != NULL) {
+        msg->swap = request;
+        intake_msg_send(msg, INTAKE_MSG_HEADER_LEN);
+    }
+}
 
-struct k_thread uart_receive_thread_data;
-struct k_thread dispatcher_thread_data;
-struct k_thread red_task_thread_data;
-struct k_thread yellow_task_thread_data;
-struct k_thread green_task_thread_data;
-
-// Määrittele FIFO-puskurit
-K_FIFO_DEFINE(red_fifo);
-K_FIFO_DEFINE(yellow_fifo);
-K_FIFO_DEFINE(green_fifo);
-
-// Määrittele condition variablet ja muteksit
-struct k_condvar red_condvar;
-struct k_condvar yellow_condvar;
-struct k_condvar green_condvar;
-struct k_mutex led_mutex;    // Suojaa FIFO-puskureita ja condition variableja
-struct k_mutex light_mutex;  // Varmistaa, että vain yksi valo on päällä kerrallaan
-struct k_mutex total_duration_mutex; // Suojaa total_duration_us
-
-// Määrittele komentojono
-K_FIFO_DEFINE(command_queue);
-
-struct command_item {
-    void *fifo_reserved; // Ensimmäinen kenttä varattu kernelille
+// Ohituskomennot tulevat UART-keskeytyksestä, jossa IPC-puskuria ei voi
+// odottaa, joten ne lähetetään työjonosta. Ryhmälle jää viimeisin pyyntö.
+struct override_request {
+    bool pending;
+    uint8_t action;  // enum override_action
     char color;
+    uint32_t duration_ms;
 };
 
-// Määrittele ring buffer
-struct ring_buffer {
-    char buffer[MAX_MSG_LEN];
-    int head;
-    int tail;
-    int count;
-};
-
-struct ring_buffer uart_buffer = {.head = 0, .tail = 0, .count = 0};
-char uart_msg[MAX_MSG_LEN];
-int uart_msg_index = 0;
+static struct override_request override_requests[SIGNAL_GROUPS];
+static struct k_spinlock override_lock;
 
-// Määrittele led_item-rakenne
-struct led_item {
-    void *fifo_reserved; // Ensimmäinen kenttä varattu kernelille
-    int duration;
-};
+static void override_send_handler(struct k_work *work) {
+    ARG_UNUSED(work);
 
-// Aikamuuttujat
-static uint32_t total_duration_us = 0;
-static uint32_t uart_sequence_start_time = 0;
-static uint32_t uart_sequence_end_time = 0;
-static uint32_t dispatcher_processing_time_us = 0;
-static bool debug_enabled = false;
+    for (int g = 0; g < SIGNAL_GROUPS; g++) {
+        k_spinlock_key_t key = k_spin_lock(&override_lock);
+        struct override_request request = override_requests[g];
+        override_requests[g].pending = false;
+        k_spin_unlock(&override_lock, key);
 
-#define DEBUG_PRINT(fmt, ...) \
-    do { if (debug_enabled) printk(fmt, ##__VA_ARGS__); } while (0)
+        if (!request.pending) {
+            continue;
+        }
+        struct intake_msg *msg = intake_msg_alloc(INTAKE_MSG_OVERRIDE, &signal_groups[g], INTAKE_MSG_HEADER_LEN);
+        if (msg != NULL) {
+            msg->override = request.action;
+            msg->override_color = request.color;
+            msg->override_ms = request.duration_ms;
+            intake_msg_send(msg, INTAKE_MSG_HEADER_LEN);
+        }
+    }
+}
 
+static K_WORK_DEFINE(override_send_work, override_send_handler);
 
-// Sekvenssin suorituksen synkronointiin
-struct k_sem sequence_sem;
+static void override_request_post(const struct signal_group *group, enum override_action action, char color,
+                                  uint32_t duration_ms) {
+    k_spinlock_key_t key = k_spin_lock(&override_lock);
+    override_requests[group->id - 1] = (struct override_request){
+        .pending = true,
+        .action = action,
+        .color = color,
+        .duration_ms = duration_ms,
+    };
+    k_spin_unlock(&override_lock, key);
+    k_work_submit(&override_send_work);
+}
 
-// UART-initialisointifunktio
-int init_uart(void) {
-    if (!device_is_ready(uart_dev)) {
-        printk("UART device not ready!\n");
-        return 1;
+// Aikakanta lähetetään sellaisena kuin se on lähetyshetkellä; IPC-viive
+// on mikrosekuntien luokkaa.
+static void coord_sync(uint64_t timebase_ms, int64_t at_ticks) {
+    struct intake_msg *msg = intake_msg_alloc(INTAKE_MSG_SYNC, &signal_groups[0], INTAKE_MSG_HEADER_LEN);
+    if (msg != NULL) {
+        msg->timebase_ms = timebase_ms + k_ticks_to_ms_near64(k_uptime_ticks() - at_ticks);
+        intake_msg_send(msg, INTAKE_MSG_HEADER_LEN);
     }
-    printk("UART initialized successfully\n");
-    return 0;
 }
 
-// GPIO-initialisointifunktio
-int init_gpio(void) {
-    if (!device_is_ready(red_led.port) || !device_is_ready(green_led.port)) {
-        printk("One or more LED devices not ready!\n");
-        return -1;
+static void coord_print(void) {
+    printk("Timebase is kept on the application core\n");
+}
+
+static void fault_reset(void) {
+    struct intake_msg *msg = intake_msg_alloc(INTAKE_MSG_FAULT_RESET, &signal_groups[0], INTAKE_MSG_HEADER_LEN);
+    if (msg != NULL) {
+        intake_msg_send(msg, INTAKE_MSG_HEADER_LEN);
+        printk("Fault reset sent to the application core\n");
     }
+}
+
+static void fault_print(void) {
+    printk("Fault monitor runs on the application core\n");
+}
+
+static void group_override(struct signal_group *group, const struct signal_color *color, uint32_t duration_ms) {
+    override_request_post(group, OVERRIDE_START, color->color, duration_ms);
+}
+
+static void group_override_end(struct signal_group *group, bool discard) {
+    override_request_post(group, discard ? OVERRIDE_DISCARD : OVERRIDE_RESUME, 0, 0);
+}
+#endif /* CONFIG_TRAFFIC_SIGNALS_INTAKE_REMOTE */
 
-    gpio_pin_configure_dt(&red_led, GPIO_OUTPUT_INACTIVE);
-    gpio_pin_configure_dt(&green_led, GPIO_OUTPUT_INACTIVE);
+static const struct ipc_ept_cfg intake_ept_cfg = {
+    .name = "traffic_intake",
+    .cb = {
+        .bound = intake_ept_bound,
+        .received = intake_ept_received,
+    },
+};
+
+// Avataan IPC-instanssi ja odotetaan, että toinen ydin on rekisteröinyt päätepisteen
+static int intake_ipc_init(void) {
+    const struct device *ipc = DEVICE_DT_GET(DT_NODELABEL(ipc0));
 
-    printk("GPIOs initialized successfully\n");
+    int ret = ipc_service_open_instance(ipc);
+    if (ret < 0 && ret != -EALREADY) {
+        return ret;
+    }
+    ret = ipc_service_register_endpoint(ipc, &intake_ept, &intake_ept_cfg);
+    if (ret < 0) {
+        return ret;
+    }
+    k_sem_take(&intake_bound_sem, K_FOREVER);
+    LOG_INF("IPC intake endpoint bound");
     return 0;
 }
+#endif /* CONFIG_TRAFFIC_SIGNALS_NETCORE || CONFIG_TRAFFIC_SIGNALS_INTAKE_REMOTE */
 
-// Ring buffer -lisäysfunktio
-void ring_buffer_put(struct ring_buffer *rb, const char *msg) {
-    for (int i = 0; msg[i] != '\0'; i++) {
-        rb->buffer[rb->head] = msg[i];
-        rb->head = (rb->head + 1) % MAX_MSG_LEN;
-        rb->count++;
-        // Vältetään ylivuoto
-        if (rb->count > MAX_MSG_LEN) {
-            rb->count = MAX_MSG_LEN;
-            rb->tail = (rb->tail + 1) % MAX_MSG_LEN;
+// Syötetään teksti jäsentimeen ja lisätään valmiit tokenit ohjelmaan.
+// Virheen sarake jää *token-rakenteeseen.
+static enum seq_parse_error program_feed(struct seq_parser *parser, struct sequence_program *program,
+                                         const char *text, bool stream, struct seq_token *token) {
+    enum seq_parse_error err = SEQ_ERR_NONE;
+
+    for (const char *ptr = text; *ptr != '\0' && err == SEQ_ERR_NONE; ptr++) {
+        enum seq_token_type type = seq_parser_feed(parser, *ptr, token);
+        if (type != SEQ_TOKEN_NONE) {
+            err = program_add_token(program, token);
+            if (stream && type == SEQ_TOKEN_STEP && err == SEQ_ERR_NONE) {
+                program_publish(program);
+            }
         }
     }
+    return err;
 }
 
-// Ring buffer -luku funktio
-int ring_buffer_get(struct ring_buffer *rb, char *msg) {
-    if (rb->count == 0) {
-        return -1;  // Puskuri on tyhjä
+// Käännetään viesti askeltaulukoksi. Palauttaa SEQ_ERR_NONE tai virhekoodin,
+// jolloin *error_column kertoo virheen sarakkeen. Jos stream on tosi,
+// jokainen valmis askel julkaistaan heti suorittajalle.
+static enum seq_parse_error compile_sequence(const char *msg, struct sequence_program *program,
+                                             uint16_t *error_column, bool stream) {
+    struct seq_parser parser;
+    struct seq_token token;
+
+    seq_parser_init(&parser);
+
+    enum seq_parse_error err = program_feed(&parser, program, msg, stream, &token);
+    if (err == SEQ_ERR_NONE && seq_parser_finish(&parser, &token) != SEQ_TOKEN_NONE) {
+        err = program_add_token(program, &token);
     }
 
-    int i = 0;
-    while (rb->count > 0 && i < MAX_MSG_LEN - 1) {
-        msg[i] = rb->buffer[rb->tail];
-        rb->tail = (rb->tail + 1) % MAX_MSG_LEN;
-        rb->count--;
-        i++;
+    *error_column = (err != SEQ_ERR_NONE) ? token.column : 0;
+    return err;
+}
+
+// Luetaan LEB128-koodattu luku. Palauttaa käytettyjen tavujen määrän,
+// 0 jos luku katkeaa kesken tai -1 jos se ei mahdu 32 bittiin.
+static int frame_read_varint(const uint8_t *data, size_t len, uint32_t *value) {
+    uint32_t result = 0;
+
+    for (size_t i = 0; i < len && i < 5; i++) {
+        if (i == 4 && data[i] > 0x0F) {
+            return -1;
+        }
+        result |= (uint32_t)(data[i] & 0x7F) << (7 * i);
+        if ((data[i] & 0x80) == 0) {
+            *value = result;
+            return i + 1;
+        }
     }
-    msg[i] = '\0'; // Lopetetaan merkkijono
-    return 0;
+    return (len >= 5) ? -1 : 0;
 }
 
-// UART-vastaanottotehtävä
-void uart_receive_task(void *p1, void *p2, void *p3) {
-    char rc;
-    printk("UART Receive Task Started\n");
+// Puretaan kehyksen hyötykuorma ohjelmaan. Virhesarake on tavun indeksi
+// hyötykuormassa. *more kertoo, jatkuuko ohjelma seuraavassa kehyksessä.
+static enum seq_parse_error decode_frame(const uint8_t *payload, size_t len, struct sequence_program *program,
+                                         uint16_t *error_column, bool stream, bool *more) {
+    enum seq_parse_error err = SEQ_ERR_NONE;
+    struct seq_token token = {0};
+    bool repeat_seen = false;
+    bool adaptive = false;  // '/' ja '@' koskevat seuraavaa askelta
+    size_t pos = 1;
 
-    while (true) {
-        // Tarkistetaan UART-tulo
-        if (uart_poll_in(uart_dev, &rc) == 0) {
-            // Tarkistetaan, että merkki ei ole pieni kirjain eikä piste
-            // Jos merkki on pieni kirjain tai piste, ohjelma pysäytetään (boottaa)
-            assert(!(rc >= 'a' && rc <= 'z'));  // Väärät merkit: pienet kirjaimet
-        assert(rc != '.' && rc != '!' && rc != '@' && rc != '#' && rc != '$' && rc != '%' && rc != '^' && rc != '&' && rc != '*');  // Väärät merkit: piste ja muut erikoismerkit
-
-            // Lähetetään merkki takaisin terminaaliin
-            uart_poll_out(uart_dev, rc);
-
-            // Tallennetaan merkki viestipuskuriin
-            uart_msg[uart_msg_index++] = rc;
-
-            // Tarkistetaan viestin loppu (rivinvaihto '\n' tai '\r')
-            if (rc == '\n' || rc == '\r' || uart_msg_index >= MAX_MSG_LEN) {
-                uart_msg[uart_msg_index - 1] = '\0';  // Lopetetaan viesti
-
-                // Käsitellään 'D' komento debug-tilan vaihtamiseksi
-                if (strcmp(uart_msg, "D,1") == 0) {
-                    debug_enabled = true;
-                    printk("Debugging enabled\n");
-                } else if (strcmp(uart_msg, "D,0") == 0) {
-                    debug_enabled = false;
-                    printk("Debugging disabled\n");
-                } else {
-                    uart_sequence_end_time = k_cycle_get_32();  // Loppuaika, kun viesti on vastaanotettu
-                    uint32_t duration_cycles = uart_sequence_end_time - uart_sequence_start_time;
-                    uint32_t duration_ns = k_cyc_to_ns_floor64(duration_cycles);
-                    uint32_t duration_us = duration_ns / 1000;
-                    DEBUG_PRINT("UART sequence received in %u us\n", duration_us);  // Raportoidaan vastaanottoaika
-
-                    // Asetetaan koko viesti ring bufferiin
-                    ring_buffer_put(&uart_buffer, uart_msg);
-                }
+    *more = (payload[0] & FRAME_FLAG_MORE) != 0;
 
-                // Nollataan viesti-indeksi seuraavaa viestiä varten
-                uart_msg_index = 0;
+    while (pos < len && err == SEQ_ERR_NONE) {
+        uint32_t value;
+        token.column = pos;
+        token.color = payload[pos];
+
+        // Toistomäärä on kehyksen viimeinen opkoodi, kuten tekstimuodossa
+        if (repeat_seen) {
+            err = SEQ_ERR_TRAILING_INPUT;
+            break;
+        }
+
+        int consumed = frame_read_varint(&payload[pos + 1], len - pos - 1, &value);
+        if (consumed <= 0) {
+            err = (consumed == 0) ? SEQ_ERR_EXPECTED_NUMBER : SEQ_ERR_NUMBER_RANGE;
+            break;
+        }
+        token.value = value;
+        pos += 1 + consumed;
+
+        // Kierrolla on kaksi lukua: pituus ja siirto
+        if (token.color == 'C') {
+            consumed = frame_read_varint(&payload[pos], len - pos, &value);
+            if (consumed <= 0 || adaptive) {
+                err = adaptive ? SEQ_ERR_EXPECTED_COLOR
+                               : (consumed == 0) ? SEQ_ERR_EXPECTED_NUMBER : SEQ_ERR_NUMBER_RANGE;
+                break;
+            }
+            pos += consumed;
+            token.type = SEQ_TOKEN_CYCLE;
+            token.max_value = value;
+            err = program_add_token(program, &token);
+            continue;
+        }
+
+        if (token.color == '/') {
+            token.max_value = value;
+            adaptive = true;
+            continue;
+        }
+        if (token.color == '@') {
+            if (!adaptive || value > UINT8_MAX) {
+                err = adaptive ? SEQ_ERR_UNKNOWN_DETECTOR : SEQ_ERR_EXPECTED_DETECTOR;
+                break;
             }
+            token.detector = value;
+            continue;
         }
-        k_msleep(10);  // Pieni viive, jotta vältetään kiireinen odotus
+        if (adaptive && token.detector == 0) {
+            err = SEQ_ERR_EXPECTED_DETECTOR;
+            break;
+        }
+
+        if (token.color == 'T') {
+            if (adaptive) {
+                err = SEQ_ERR_EXPECTED_COLOR;
+                break;
+            }
+            repeat_seen = true;
+            token.type = SEQ_TOKEN_REPEAT;
+            if (value < 1 || value > MAX_REPEAT_TIMES) {
+                err = SEQ_ERR_REPEAT_RANGE;
+                break;
+            }
+        } else {
+            token.type = SEQ_TOKEN_STEP;
+            if (!adaptive) {
+                token.max_value = value;
+            }
+        }
+
+        err = program_add_token(program, &token);
+        if (stream && token.type == SEQ_TOKEN_STEP && err == SEQ_ERR_NONE) {
+            program_publish(program);
+        }
+        adaptive = false;
+        token.detector = 0;
     }
+    if (err == SEQ_ERR_NONE && adaptive) {
+        err = SEQ_ERR_EXPECTED_COLOR;  // Ilmaisinparametrit ilman askelta
+    }
+
+    *error_column = (err != SEQ_ERR_NONE) ? token.column : 0;
+    return err;
 }
 
+// Monikehyksinen ohjelma, jonka seuraavaa kehystä odotetaan
+static struct sequence_program *frame_program;
+static bool frame_program_stream;
 
-// Dispatcher-tehtävä
-void dispatcher_task(void *p1, void *p2, void *p3) {
-    printk("Dispatcher Task Started\n");
+// Keskeneräinen monikehyksinen ohjelma hylätään, jos väliin tulee tekstirivi
+// tai toisen ryhmän kehys
+static void abort_frame_program(const char *reason) {
+    if (frame_program != NULL) {
+        LOG_WRN("Framed sequence aborted by %s", reason);
+        program_close(frame_program, false);
+        frame_program = NULL;
+    }
+}
 
-    char msg[MAX_MSG_LEN];
-    char *ptr;
-    char color;
-    int duration;
-    char command_sequence[MAX_MSG_LEN] = {0};
-    int repeat_times = 1;
+// Monirivinen aikataulu '[@n:]BEGIN' ... 'END'. Rivit syötetään samaan
+// jäsentimeen suoraan ryhmän slottiin, joten pituutta rajaa slotin koko
+// (CONFIG_TRAFFIC_SIGNALS_MAX_STEPS) eikä rivipuskuri. Rivinvaihto on
+// erotin, joten askel ei saa katketa värin ja pilkun väliin.
+struct upload {
+    struct signal_group *group;        // Lähetys käynnissä tai NULL
+    struct sequence_program *program;  // NULL, kun lähetys on jo hylätty
+    struct seq_parser parser;
+    bool stream;
+    uint32_t lines;
+};
 
-    while (true) {
-        // Haetaan seuraava viesti ring bufferista
-        if (ring_buffer_get(&uart_buffer, msg) == 0) {
-            DEBUG_PRINT("Dispatcher received message: %s\n", msg);
+static struct upload upload;  // Vain dispatcher käyttää
 
-            uint32_t start_time = k_cycle_get_32();
+static void upload_reject(enum seq_parse_error err, uint16_t column) {
+    LOG_WRN("[%u] Upload rejected: %s at line %u column %u", upload.group->id, seq_parse_error_names[err],
+            upload.lines, column);
+    upload.program->error = err;
+    program_close(upload.program, false);
+    upload.program = NULL;  // Loput rivit END:iin asti ohitetaan
+}
 
-            // Resetoi total_duration_us ja komento-laskuri
-            k_mutex_lock(&total_duration_mutex, K_FOREVER);
-            total_duration_us = 0;
-            k_mutex_unlock(&total_duration_mutex);
-
-            int command_count = 0;  // Komentojen määrä tässä sekvenssissä
-
-            // Etsitään 'T' viestistä
-            char *t_ptr = strchr(msg, 'T');
-            if (t_ptr != NULL) {
-                // Kopioidaan sekvenssi ennen 'T'-merkkiä
-                int sequence_len = t_ptr - msg;
-                strncpy(command_sequence, msg, sequence_len);
-                command_sequence[sequence_len] = '\0';
-
-                // Luetaan toistojen määrä 'T' jälkeen
-                if (sscanf(t_ptr, "T,%d", &repeat_times) != 1) {
-                    DEBUG_PRINT("Invalid repeat format in message\n");
-                    repeat_times = 1; // Oletusarvo 1, jos jäsennys epäonnistuu
-                }
+// Keskeytetään kesken jäänyt lähetys
+static void upload_abort(const char *reason) {
+    if (upload.group != NULL) {
+        LOG_WRN("[%u] Upload aborted by %s", upload.group->id, reason);
+        if (upload.program != NULL) {
+            program_close(upload.program, false);
+        }
+        upload.group = NULL;
+    }
+}
 
-                // Assert, jotta toistomäärä ei ylitä järkevää arvoa
-                assert(repeat_times >= 1 && repeat_times <= 100);  // Oletetaan, että 100 on maksimi toistomäärä
-            } else {
-                // Ei 'T'-merkkiä, käytetään koko viestiä sekvenssinä
-                strcpy(command_sequence, msg);
-                repeat_times = 1;
-            }
-
-            // Toistetaan sekvenssi 'repeat_times' kertaa
-            for (int r = 0; r < repeat_times; r++) {
-                ptr = command_sequence;
-                while (*ptr != '\0') {
-                    int n = 0;
-                    if (sscanf(ptr, "%c,%d%n", &color, &duration, &n) != 2) {
-                        DEBUG_PRINT("Invalid format in sequence\n");
-                        break;
-                    }
-
-                    DEBUG_PRINT("Color: %c, Duration: %d ms\n", color, duration);
-
-                    struct led_item *led_data = k_malloc(sizeof(struct led_item));
-                    
-                    // Assert tarkistamaan, että muistiallokaatio onnistuu
-                    assert(led_data != NULL);  // Jos muistia ei voida varata, ohjelma pysäytetään
-
-                    led_data->duration = duration;
-
-                    k_mutex_lock(&led_mutex, K_FOREVER);
-                    switch (color) {
-                        case 'R':
-                            k_fifo_put(&red_fifo, led_data);
-                            k_condvar_signal(&red_condvar);
-                            break;
-                        case 'G':
-                            k_fifo_put(&green_fifo, led_data);
-                            k_condvar_signal(&green_condvar);
-                            break;
-                        case 'Y':
-                            k_fifo_put(&yellow_fifo, led_data);
-                            k_condvar_signal(&yellow_condvar);
-                            break;
-                        default:
-                            DEBUG_PRINT("Unknown color received: %c\n", color);
-                            k_free(led_data);
-                            break;
-                    }
-                    k_mutex_unlock(&led_mutex);
-
-                    // Lisää komento command_queue-jonoon
-                    struct command_item *cmd_item = k_malloc(sizeof(struct command_item));
-
-                    // Assert tarkistamaan muistiallokaatio komentoja varten
-                    assert(cmd_item != NULL);  // Jos muistia ei voida varata, ohjelma pysäytetään
-
-                    cmd_item->color = color;
-                    k_fifo_put(&command_queue, cmd_item);
-
-                    // Päivitä komento-laskuri
-                    command_count++;
-
-                    ptr += n;  // Siirretään osoitinta eteenpäin jäsennetyn osuuden verran
-
-                    // Ohitetaan mahdolliset ylimääräiset pilkut tai välilyönnit
-                    while (*ptr == ',' || *ptr == ' ') {
-                        ptr++;
-                    }
-                }
-            }
+static void upload_begin(struct signal_group *group) {
+    upload_abort("BEGIN");
+
+    upload.group = group;
+    upload.program = program_alloc(group);
+    upload.stream =
+        !IS_ENABLED(CONFIG_TRAFFIC_SIGNALS_VALIDATE_FIRST) && atomic_get(&group->programs_pending) == 0;
+    upload.lines = 0;
+    seq_parser_init(&upload.parser);
+    printk("[%u] Upload started\n", group->id);
+}
 
-            // Alustetaan sekvenssin semafori
-            k_sem_reset(&sequence_sem);
+static void upload_line(const char *line) {
+    struct seq_token token;
 
-            // Odotetaan, että kaikki valotaskit ovat suorittaneet tehtävänsä
-            for (int i = 0; i < command_count; i++) {
-                k_sem_take(&sequence_sem, K_FOREVER);
-            }
+    upload.lines++;
+    if (upload.program == NULL) {
+        return;
+    }
 
-            // Tulostetaan sekvenssin yhteenlaskettu aika
-            k_mutex_lock(&total_duration_mutex, K_FOREVER);
-            DEBUG_PRINT("Total sequence duration: %u us\n", total_duration_us);
-            k_mutex_unlock(&total_duration_mutex);
+    // Sarake lasketaan rivin alusta; jäsentimen laskuri kulkee koko lähetyksen yli
+    uint16_t line_start = upload.parser.column;
+    enum seq_parse_error err = program_feed(&upload.parser, upload.program, line, upload.stream, &token);
+    if (err == SEQ_ERR_NONE) {
+        err = program_feed(&upload.parser, upload.program, " ", upload.stream, &token);
+    }
+    if (err != SEQ_ERR_NONE) {
+        upload_reject(err, (uint16_t)(token.column - line_start));
+    }
+}
 
-            uint32_t end_time = k_cycle_get_32();  // Loppumittaus
-            uint32_t duration_cycles = end_time - start_time;
-            uint32_t duration_ns = k_cyc_to_ns_floor64(duration_cycles);
-            dispatcher_processing_time_us = duration_ns / 1000;
+static void upload_end(void) {
+    struct signal_group *group = upload.group;
+    struct sequence_program *program = upload.program;
+    struct seq_token token;
 
-            DEBUG_PRINT("Dispatcher processed sequence in %u us\n", dispatcher_processing_time_us);
+    if (program != NULL) {
+        enum seq_parse_error err = SEQ_ERR_NONE;
+        if (seq_parser_finish(&upload.parser, &token) != SEQ_TOKEN_NONE) {
+            err = program_add_token(program, &token);
         }
+        if (err != SEQ_ERR_NONE) {
+            upload_reject(err, 0);
+        } else {
+            printk("[%u] Upload done: %u steps in %u lines\n", group->id, program->step_count, upload.lines);
+            program_close(program, true);
+        }
+    }
+    if (upload.program == NULL) {
+        printk("[%u] Upload rejected\n", group->id);
+    }
+    upload.group = NULL;
+}
 
-        k_msleep(10);  // Pieni viive, jotta vältetään kiireinen odotus
+// Erotetaan rivin alusta ryhmäosoite '@n:'. Ilman etuliitettä rivi koskee
+// ryhmää 1. Palauttaa osoitteen jälkeisen osan tai NULL, jos ryhmää ei ole.
+static const char *parse_group_prefix(const char *msg, struct signal_group **group) {
+    unsigned int id = 1;
+
+    if (msg[0] == '@') {
+        const char *ptr = msg + 1;
+        id = 0;
+        while (*ptr >= '0' && *ptr <= '9' && id <= SIGNAL_GROUPS) {
+            id = id * 10 + (*ptr - '0');
+            ptr++;
+        }
+        if (ptr == msg + 1 || *ptr != ':') {
+            return NULL;
+        }
+        msg = ptr + 1;
     }
+
+    *group = find_signal_group(id);
+    return (*group != NULL) ? msg : NULL;
 }
 
-// Punaisen valon tehtävä
-void red_light_task(void *p1, void *p2, void *p3) {
-    while (true) {
-        // Odota, että FIFOssa on dataa
-        k_mutex_lock(&led_mutex, K_FOREVER);
-        while (k_fifo_is_empty(&red_fifo)) {
-            k_condvar_wait(&red_condvar, &led_mutex, K_FOREVER);
-        }
-        k_mutex_unlock(&led_mutex);
-
-        // Odota vuoroasi command_queue-jonossa
-        struct command_item *cmd_item = NULL;
-        while (true) {
-            cmd_item = k_fifo_peek_head(&command_queue);
-            if (cmd_item != NULL && cmd_item->color == 'R') {
-                // On meidän vuoro
-                k_fifo_get(&command_queue, K_NO_WAIT);
-                k_free(cmd_item);
-                break;
-            } else {
-                // Ei meidän vuoro, odotetaan hetki
-                k_msleep(1);
+// Ohituskomento '[@n:]!C[,ms]', '[@n:]!>' tai '[@n:]!X'. Käsitellään
+// suoraan UART-keskeytyksessä, joten komento ohittaa jonossa odottavat rivit
+// ja käynnissä olevan käännöksen. Ilman ryhmäosoitetta komento koskee
+// kaikkia ryhmiä. Palauttaa false, jos rivi ei ole ohituskomento.
+static bool override_line(const char *line, uint32_t end_cycles, bool *accepted) {
+    const char *colon = (line[0] == '@') ? strchr(line, ':') : NULL;
+    const char *body = (colon != NULL) ? colon + 1 : line;
+    unsigned int first = 1;
+    unsigned int last = SIGNAL_GROUPS;
+
+    if (body[0] != '!') {
+        return false;
+    }
+    *accepted = false;
+    if (colon != NULL) {
+        struct signal_group *group;
+        if (parse_group_prefix(line, &group) == NULL) {
+            LOG_WRN("Override rejected: unknown signal group");
+            return true;
+        }
+        first = last = group->id;
+    }
+
+    enum override_action action = OVERRIDE_START;
+    uint32_t duration_ms = 0;
+
+    if (strcmp(body, "!>") == 0) {
+        action = OVERRIDE_RESUME;
+    } else if (strcmp(body, "!X") == 0) {
+        action = OVERRIDE_DISCARD;
+    } else if (body[1] == '\0' || (body[2] != '\0' && body[2] != ',')) {
+        LOG_WRN("Override rejected: bad syntax");
+        return true;
+    } else if (body[2] == ',') {
+        char *end;
+        unsigned long value = strtoul(&body[3], &end, 10);
+        if (end == &body[3] || *end != '\0' || value == 0 || value > MAX_OVERRIDE_MS) {
+            LOG_WRN("Override rejected: bad duration");
+            return true;
+        }
+        duration_ms = value;
+    }
+
+    int applied = 0;
+    for (unsigned int id = first; id <= last; id++) {
+        struct signal_group *group = find_signal_group(id);
+        if (group == NULL) {
+            continue;
+        }
+        if (action == OVERRIDE_START) {
+            const struct signal_color *color = signal_group_color(group, body[1]);
+            if (color == NULL) {
+                continue;
             }
+            group_override(group, color, duration_ms);
+        } else {
+            group_override_end(group, action == OVERRIDE_DISCARD);
+        }
+        applied++;
+    }
+
+    if (applied == 0) {
+        LOG_WRN("Override rejected: colour %c not available", body[1]);
+    } else {
+        *accepted = true;
+        LOG_INF("Override !%c applied to %d groups, %u us after end of line", body[1], applied,
+                k_cyc_to_us_floor32(k_cycle_get_32() - end_cycles));
+    }
+    return true;
+}
+
+// Aikakannan asetus SYNC,<t> (t millisekunteina). Rivin loppuhetki
+// otetaan keskeytyksen aikaleimasta, joten jonossa odotus ei näy virheenä.
+static void dispatch_sync(const char *arg, uint32_t received_cycles) {
+    char *end;
+    unsigned long long timebase_ms = strtoull(arg, &end, 10);
+
+    if (strcmp(arg, "?") == 0) {
+        coord_print();
+        return;
+    }
+    if (end == arg || *end != '\0') {
+        LOG_WRN("SYNC rejected: expected time in ms");
+        return;
+    }
+    int64_t at_ticks = k_uptime_ticks() - (int64_t)k_cyc_to_ticks_floor64(k_cycle_get_32() - received_cycles);
+    coord_sync(timebase_ms, at_ticks);
+    printk("Timebase set to %llu ms\n", timebase_ms);
+}
+
+// Tarkistusajo 'V,[@n:]<sekvenssi>': käännetään erilliseen ohjelmaan, jota ei
+// anneta suorittajalle. Tulos yhdellä rivillä:
+// V,OK,steps=<n>/<max>,repeat=<n>,cycle_ms=<min>,max_cycle_ms=<max>,total_ms=<max>,bytes=<tallenne>
+// tai V,ERROR,column=<sarake>,<virhe>. Kestot ovat koordinoidulla sekvenssillä kierron pituus.
+static struct sequence_program validate_program;  // Vain dispatcher käyttää
+
+static void dispatch_validate(const char *msg) {
+    struct sequence_program *program = &validate_program;
+    const char *body = parse_group_prefix(msg, &program->group);
+
+    if (body == NULL) {
+        printk("V,ERROR,column=1,unknown signal group\n");
+        return;
+    }
+
+    program_init(program);
+    uint16_t error_column;
+    enum seq_parse_error err = compile_sequence(body, program, &error_column, false);
+    if (err != SEQ_ERR_NONE) {
+        // Sarake koko riviltä, ryhmäosoite mukaan luettuna
+        printk("V,ERROR,column=%u,%s\n", (unsigned int)(error_column + (body - msg)), seq_parse_error_names[err]);
+        return;
+    }
+
+    uint64_t cycle_ms = 0;
+    for (uint16_t i = 0; i < program->step_count; i++) {
+        cycle_ms += program->steps[i].duration;
+    }
+    uint64_t max_cycle_ms = program->max_total_ms;
+    if (program->cycle_ms != 0) {
+        cycle_ms = program->cycle_ms;
+        max_cycle_ms = program->cycle_ms;
+    }
+    printk("V,OK,steps=%u/%u,repeat=%u,cycle_ms=%llu,max_cycle_ms=%llu,total_ms=%llu,bytes=%u\n",
+           program->step_count, MAX_PROGRAM_STEPS, program->repeat_times, cycle_ms, max_cycle_ms,
+           max_cycle_ms * program->repeat_times,
+           (unsigned int)(SCHEDULE_RECORD_HEADER_LEN + program->step_count * sizeof(struct sequence_step)));
+}
+
+// Käännetään ASCII-rivi ryhmän ohjelmaksi tai käsitellään SWAP. SWAP kulkee
+// rivijonon kautta, joten se ei ohita ennen sitä lähetettyä sekvenssiä.
+static void dispatch_text(const char *msg, uint32_t received_cycles) {
+    LOG_DBG("Dispatcher received message: %s", msg);
+
+    // Tarkistusajo ei koske vastaanotettavaan kehysohjelmaan
+    if (strncmp(msg, "V,", 2) == 0) {
+        dispatch_validate(msg + 2);
+        return;
+    }
+
+    abort_frame_program("text line");
+
+    if (strncmp(msg, "SYNC,", 5) == 0) {
+        dispatch_sync(msg + 5, received_cycles);
+        return;
+    }
+    if (strcmp(msg, "FAULT,?") == 0) {
+        fault_print();
+        return;
+    } else if (strcmp(msg, "FAULT,0") == 0) {
+        fault_reset();
+        return;
+    }
+    if (strcmp(msg, "END") == 0) {
+        if (upload.group != NULL) {
+            upload_end();
+        } else {
+            LOG_WRN("END without BEGIN");
         }
+        return;
+    }
 
-        // Prosessoi oma FIFO
-        struct led_item *item;
-        k_mutex_lock(&led_mutex, K_FOREVER);
-        item = k_fifo_get(&red_fifo, K_NO_WAIT);
-        k_mutex_unlock(&led_mutex);
+    // SWAP ja uusi BEGIN toimivat myös lähetyksen aikana, muut rivit ovat sen sisältöä
+    struct signal_group *group;
+    const char *body = parse_group_prefix(msg, &group);
+    if (body != NULL && strcmp(body, "BEGIN") == 0) {
+        upload_begin(group);
+        return;
+    } else if (body != NULL && strcmp(body, "SWAP") == 0) {
+        group_request_swap(group, SWAP_STEP);
+        printk("[%u] Swap at next step\n", group->id);
+        return;
+    } else if (body != NULL && strcmp(body, "SWAP,C") == 0) {
+        group_request_swap(group, SWAP_CYCLE);
+        printk("[%u] Swap at end of cycle\n", group->id);
+        return;
+    }
+    if (upload.group != NULL) {
+        upload_line(msg);
+        return;
+    }
+    if (body == NULL) {
+        LOG_WRN("Sequence rejected: unknown signal group");
+        return;
+    }
 
-        if (item != NULL) {
-            uint32_t start_time = k_cycle_get_32();
+    struct sequence_program *program = program_alloc(group);
+    if (program == NULL) {
+        return;
+    }
 
-            k_mutex_lock(&light_mutex, K_FOREVER);
-            printk("Red light ON for %d ms\n", item->duration);
-            gpio_pin_set_dt(&green_led, 0);  // Varmista, että vihreä LED on pois päältä
-            gpio_pin_set_dt(&red_led, 1);    // Sytytä punainen LED
-            k_msleep(item->duration);
-            gpio_pin_set_dt(&red_led, 0);    // Sammuta punainen LED
-            printk("Red light OFF\n");
-            k_mutex_unlock(&light_mutex);
+    // Jos ryhmän suorittaja on vapaa (ja CONFIG_TRAFFIC_SIGNALS_VALIDATE_FIRST
+    // ei ole päällä), ensimmäinen askel käynnistyy heti kun se on käännetty.
+    // Muuten sekvenssi käännetään ja tarkistetaan kokonaan valmiustilaslottiin,
+    // josta se käynnistyy SWAP-komennolla tai kun aktiivinen aikataulu päättyy.
+    bool stream = !IS_ENABLED(CONFIG_TRAFFIC_SIGNALS_VALIDATE_FIRST) && atomic_get(&group->programs_pending) == 0;
 
-            uint32_t end_time = k_cycle_get_32();
-            uint32_t duration_cycles = end_time - start_time;
-            uint32_t duration_ns = k_cyc_to_ns_floor64(duration_cycles);
-            uint32_t duration_us = duration_ns / 1000;
+    uint16_t error_column;
+    enum seq_parse_error err = compile_sequence(body, program, &error_column, stream);
+    if (err != SEQ_ERR_NONE) {
+        LOG_WRN("[%u] Sequence rejected: %s at column %u", group->id, seq_parse_error_names[err], error_column);
+        program->error = err;
+    } else if (program->step_count == 0) {
+        LOG_DBG("No steps in sequence");
+    }
+    program_close(program, err == SEQ_ERR_NONE);
+}
+
+// Puretaan binäärikehys ohjelmaksi ja kuitataan se ACK- tai NAK-tavulla
+static void dispatch_frame(const uint8_t *payload, size_t len) {
+    struct signal_group *group = find_signal_group((payload[0] >> FRAME_FLAG_GROUP_SHIFT) + 1);
 
-            // Päivitä total_duration_us
-            k_mutex_lock(&total_duration_mutex, K_FOREVER);
-            total_duration_us += duration_us;
-            k_mutex_unlock(&total_duration_mutex);
+    upload_abort("binary frame");
 
-            // Tulosta yksittäisen tehtävän aika
-            printk("Red task duration: %u us\n", duration_us);
+    if (frame_program != NULL && frame_program->group != group) {
+        abort_frame_program("frame for another group");
+    }
+    if (group == NULL) {
+        LOG_WRN("Frame rejected: unknown signal group");
+        metrics_count(&metrics.frames_rejected, 1);
+        uart_tx_byte(FRAME_NAK);
+        return;
+    }
 
-            // Ilmoita dispatcherille, että tehtävä on suoritettu
-            k_sem_give(&sequence_sem);
+    struct sequence_program *program = frame_program;
+    bool stream = frame_program_stream;
 
-            k_free(item);
+    if (program == NULL) {
+        program = program_alloc(group);
+        if (program == NULL) {
+            metrics_count(&metrics.frames_rejected, 1);
+            uart_tx_byte(FRAME_NAK);
+            return;
         }
+        stream = !IS_ENABLED(CONFIG_TRAFFIC_SIGNALS_VALIDATE_FIRST) && atomic_get(&group->programs_pending) == 0;
+    }
+    frame_program = NULL;
+
+    bool more;
+    uint16_t error_column;
+    enum seq_parse_error err = decode_frame(payload, len, program, &error_column, stream, &more);
+    if (err != SEQ_ERR_NONE) {
+        LOG_WRN("[%u] Frame rejected: %s at byte %u", group->id, seq_parse_error_names[err], error_column);
+        program->error = err;
+        program_close(program, false);
+        metrics_count(&metrics.frames_rejected, 1);
+        uart_tx_byte(FRAME_NAK);
+        return;
     }
+
+    metrics_count(&metrics.frames_accepted, 1);
+    uart_tx_byte(FRAME_ACK);
+
+    if (more) {
+        frame_program = program;
+        frame_program_stream = stream;
+        return;
+    }
+    program_close(program, true);
 }
 
-// Vihreän valon tehtävä
-void green_light_task(void *p1, void *p2, void *p3) {
-    while (true) {
-        // Odota, että FIFOssa on dataa
-        k_mutex_lock(&led_mutex, K_FOREVER);
-        while (k_fifo_is_empty(&green_fifo)) {
-            k_condvar_wait(&green_condvar, &led_mutex, K_FOREVER);
-        }
-        k_mutex_unlock(&led_mutex);
-
-        // Odota vuoroasi command_queue-jonossa
-        struct command_item *cmd_item = NULL;
-        while (true) {
-            cmd_item = k_fifo_peek_head(&command_queue);
-            if (cmd_item != NULL && cmd_item->color == 'G') {
-                // On meidän vuoro
-                k_fifo_get(&command_queue, K_NO_WAIT);
-                k_free(cmd_item);
-                break;
-            } else {
-                // Ei meidän vuoro, odotetaan hetki
-                k_msleep(1);
-            }
+// Hylätty liian pitkä rivi katkaisee monikehyksisen ohjelman kuten muukin
+// tekstirivi, ja lähetyksen aikana se hylkää koko lähetyksen
+static void dispatch_overlong(void) {
+    abort_frame_program("text line");
+    if (upload.group != NULL) {
+        upload.lines++;
+        if (upload.program != NULL) {
+            upload_reject(SEQ_ERR_LINE_TOO_LONG, 0);
         }
+    }
+}
+
+// Dispatcher-tehtävä
+void dispatcher_task(void *p1, void *p2, void *p3) {
+    LOG_INF("Dispatcher Task Started");
 
-        // Prosessoi oma FIFO
-        struct led_item *item;
-        k_mutex_lock(&led_mutex, K_FOREVER);
-        item = k_fifo_get(&green_fifo, K_NO_WAIT);
-        k_mutex_unlock(&led_mutex);
+    char msg[MAX_MSG_LEN];
 
-        if (item != NULL) {
+    while (true) {
+        // Odotetaan seuraavaa viestiä rivijonosta
+        struct line_record_header header;
+        int len = line_queue_get(&uart_line_queue, msg, sizeof(msg), &header, K_FOREVER);
+        if (len >= 0) {
             uint32_t start_time = k_cycle_get_32();
+            metrics_record(&metrics.line_to_dispatch, k_cyc_to_us_floor32(start_time - header.received_cycles));
 
-            k_mutex_lock(&light_mutex, K_FOREVER);
-            printk("Green light ON for %d ms\n", item->duration);
-            gpio_pin_set_dt(&red_led, 0);    // Varmista, että punainen LED on pois päältä
-            gpio_pin_set_dt(&green_led, 1);  // Sytytä vihreä LED
-            k_msleep(item->duration);
-            gpio_pin_set_dt(&green_led, 0);  // Sammuta vihreä LED
-            printk("Green light OFF\n");
-            k_mutex_unlock(&light_mutex);
+            if (header.type == LINE_FRAME) {
+                dispatch_frame((const uint8_t *)msg, len);
+            } else if (header.type == LINE_OVERLONG) {
+                dispatch_overlong();
+            } else {
+                dispatch_text(msg, header.received_cycles);
+            }
 
-            uint32_t end_time = k_cycle_get_32();
+            uint32_t end_time = k_cycle_get_32();  // Loppumittaus
             uint32_t duration_cycles = end_time - start_time;
             uint32_t duration_ns = k_cyc_to_ns_floor64(duration_cycles);
-            uint32_t duration_us = duration_ns / 1000;
+            dispatcher_processing_time_us = duration_ns / 1000;
+
+            LOG_DBG("Dispatcher processed sequence in %u us", dispatcher_processing_time_us);
+        }
+    }
+}
+
+#ifdef CONFIG_TRAFFIC_SIGNALS_BENCHMARK
+// Suorituskykytesti (native_sim tai kortti). Tulosrivit alkavat "BENCH,",
+// jotta ne voidaan kerätä konsolilokista ja verrata muutosten välillä.
+// Jäsennysaika mitataan ajoitusfunktioiden laskurilla, koska
+// järjestelmäkello on nRF5340:llä 32768 Hz:n RTC. native_sim ei mallinna
+// suoritinaikaa, joten läpäisy mitataan kortilla ja ajoitusvirhe kummalla tahansa.
+#define BENCH_STEP_DURATION_MS 5
+#define BENCH_LINE_STEPS 60  // Askelia riviä kohden, lyhyt ohjelma mahtuu yhdelle riville
 
-            // Päivitä total_duration_us
-            k_mutex_lock(&total_duration_mutex, K_FOREVER);
-            total_duration_us += duration_us;
-            k_mutex_unlock(&total_duration_mutex);
+static const uint32_t bench_parse_steps[] = {1, 10, 100, 1000, 10000};
+static const uint16_t bench_repeats[] = {1, 10, 100};
+static const uint16_t bench_run_steps[] = {1, 10, 60, 1000, 10000};
 
-            // Tulosta yksittäisen tehtävän aika
-            printk("Green task duration: %u us\n", duration_us);
+// Lisätään luku merkkijonoon, palauttaa uuden pituuden
+static size_t bench_append_uint(char *buf, size_t pos, uint32_t value) {
+    char digits[10];
+    int n = 0;
 
-            // Ilmoita dispatcherille, että tehtävä on suoritettu
-            k_sem_give(&sequence_sem);
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+    while (n > 0) {
+        buf[pos++] = digits[--n];
+    }
+    return pos;
+}
+
+// Synteettisen sekvenssin askel i: väri R/G/Y ja kesto 1..999 ms
+static size_t bench_format_step(char *buf, uint32_t i, uint32_t duration_ms) {
+    size_t pos = 0;
+
+    buf[pos++] = "RGY"[i % 3];
+    buf[pos++] = ',';
+    pos = bench_append_uint(buf, pos, duration_ms);
+    buf[pos++] = ',';
+    return pos;
+}
+
+static size_t bench_format_repeat(char *buf, uint16_t repeat) {
+    size_t pos = 0;
+
+    buf[pos++] = 'T';
+    buf[pos++] = ',';
+    return bench_append_uint(buf, pos, repeat);
+}
 
-            k_free(item);
+// Syötetään sekvenssi merkki kerrallaan jäsentimelle; näin pituutta ei
+// rajoita rivipuskuri eikä askeltaulukko
+static void bench_parse(uint32_t steps, uint16_t repeat) {
+    struct seq_parser parser;
+    struct seq_token token;
+    char chunk[16];
+    uint32_t chars = 0;
+    uint32_t tokens = 0;
+    bool ok = true;
+
+    seq_parser_init(&parser);
+    timing_t start = timing_counter_get();
+
+    for (uint32_t i = 0; i <= steps && ok; i++) {
+        size_t len = (i < steps) ? bench_format_step(chunk, i, 1 + (i * 37) % 999) : bench_format_repeat(chunk, repeat);
+        for (size_t c = 0; c < len && ok; c++) {
+            enum seq_token_type type = seq_parser_feed(&parser, chunk[c], &token);
+            ok = type != SEQ_TOKEN_ERROR;
+            tokens += (type != SEQ_TOKEN_NONE);
         }
+        chars += len;
     }
+    if (ok && seq_parser_finish(&parser, &token) != SEQ_TOKEN_NONE) {
+        ok = token.type != SEQ_TOKEN_ERROR;
+        tokens++;
+    }
+
+    timing_t end = timing_counter_get();
+    uint64_t cycles = timing_cycles_get(&start, &end);
+    uint64_t ns = timing_cycles_to_ns(cycles);
+    printk("BENCH,parse,steps=%u,repeat=%u,chars=%u,tokens=%u,ok=%d,cycles=%u,ns_per_step=%u,kchar_per_s=%u\n",
+           steps, repeat, chars, tokens, ok, (uint32_t)cycles, (uint32_t)(ns / steps),
+           ns > 0 ? (uint32_t)((uint64_t)chars * 1000000 / ns) : 0);
 }
 
-// Keltaisen valon tehtävä
-void yellow_light_task(void *p1, void *p2, void *p3) {
-    while (true) {
-        // Odota, että FIFOssa on dataa
-        k_mutex_lock(&led_mutex, K_FOREVER);
-        while (k_fifo_is_empty(&yellow_fifo)) {
-            k_condvar_wait(&yellow_condvar, &led_mutex, K_FOREVER);
-        }
-        k_mutex_unlock(&led_mutex);
-
-        // Odota vuoroasi command_queue-jonossa
-        struct command_item *cmd_item = NULL;
-        while (true) {
-            cmd_item = k_fifo_peek_head(&command_queue);
-            if (cmd_item != NULL && cmd_item->color == 'Y') {
-                // On meidän vuoro
-                k_fifo_get(&command_queue, K_NO_WAIT);
-                k_free(cmd_item);
-                break;
-            } else {
-                // Ei meidän vuoro, odotetaan hetki
-                k_msleep(1);
+// Ajetaan ohjelma oikeaa polkua pitkin (UART-rivijono, vastaanottosäie,
+// rivijono, dispatcher, suorittaja) ja odotetaan, että ryhmä 1 on valmis.
+// Rivit annetaan samaan viestijonoon kuin UART-keskeytys antaa, joten
+// rivijonolla on edelleen vain yksi kirjoittaja. Yhdelle riville
+// mahtumaton ohjelma lähetetään BEGIN/END-lähetyksenä, ja seuraava rivi
+// annetaan vasta, kun jonot ovat tyhjiä, jotta mitään ei hylätä.
+// Ajoitusvirhe luetaan histogrammista.
+static struct uart_line bench_line;
+
+static bool bench_send_line(size_t len) {
+    bench_line.data[len] = '\0';
+    bench_line.len = len;
+    bench_line.type = LINE_TEXT;
+    bench_line.start_cycles = k_cycle_get_32();
+    bench_line.end_cycles = bench_line.start_cycles;
+    if (k_msgq_put(&uart_line_msgq, &bench_line, K_MSEC(100)) != 0) {
+        return false;
+    }
+    while (k_msgq_num_used_get(&uart_line_msgq) != 0 ||
+           atomic_get(&uart_line_queue.head) != atomic_get(&uart_line_queue.tail)) {
+        k_msleep(1);
+    }
+    return true;
+}
+
+static bool bench_send_program(uint16_t steps, uint16_t repeat) {
+    bool upload = steps > BENCH_LINE_STEPS;
+    size_t len = 0;
+
+    if (upload) {
+        len = strlen(strcpy(bench_line.data, "BEGIN"));
+        if (!bench_send_line(len)) {
+            return false;
+        }
+        len = 0;
+    }
+    for (uint16_t i = 0; i < steps; i++) {
+        len += bench_format_step(&bench_line.data[len], i, BENCH_STEP_DURATION_MS);
+        // Rivinvaihto erottaa askeleet, joten rivin viimeinen pilkku jätetään pois
+        if (upload && (i + 1) % BENCH_LINE_STEPS == 0 && i + 1 < steps) {
+            if (!bench_send_line(len - 1)) {
+                return false;
             }
+            len = 0;
         }
+    }
+    len += bench_format_repeat(&bench_line.data[len], repeat);
+    if (!bench_send_line(len)) {
+        return false;
+    }
+    return !upload || bench_send_line(strlen(strcpy(bench_line.data, "END")));
+}
 
-        // Prosessoi oma FIFO
-        struct led_item *item;
-        k_mutex_lock(&led_mutex, K_FOREVER);
-        item = k_fifo_get(&yellow_fifo, K_NO_WAIT);
-        k_mutex_unlock(&led_mutex);
+static void bench_run(uint16_t steps, uint16_t repeat) {
+    struct signal_group *group = find_signal_group(1);
 
-        if (item != NULL) {
-            uint32_t start_time = k_cycle_get_32();
+    // Slottiin mahtumaton ohjelma ohitetaan, raja näkyy tulosrivillä
+    if (steps > MAX_PROGRAM_STEPS) {
+        printk("BENCH,run,steps=%u,repeat=%u,skipped=max_steps,max_steps=%u\n", steps, repeat, MAX_PROGRAM_STEPS);
+        return;
+    }
 
-            k_mutex_lock(&light_mutex, K_FOREVER);
-            printk("Yellow light (Red + Green) ON for %d ms\n", item->duration);
-            gpio_pin_set_dt(&red_led, 1);    // Sytytä punainen LED
-            gpio_pin_set_dt(&green_led, 1);  // Sytytä vihreä LED
-            k_msleep(item->duration);
-            gpio_pin_set_dt(&red_led, 0);    // Sammuta punainen LED
-            gpio_pin_set_dt(&green_led, 0);  // Sammuta vihreä LED
-            printk("Yellow light OFF\n");
-            k_mutex_unlock(&light_mutex);
-
-            uint32_t end_time = k_cycle_get_32();
-            uint32_t duration_cycles = end_time - start_time;
-            uint32_t duration_ns = k_cyc_to_ns_floor64(duration_cycles);
-            uint32_t duration_us = duration_ns / 1000;
+    metrics_reset();
+    if (!bench_send_program(steps, repeat)) {
+        printk("BENCH,run,steps=%u,repeat=%u,error=queue_full\n", steps, repeat);
+        return;
+    }
 
-            // Päivitä total_duration_us
-            k_mutex_lock(&total_duration_mutex, K_FOREVER);
-            total_duration_us += duration_us;
-            k_mutex_unlock(&total_duration_mutex);
+    // Odotetaan ohjelman alkua ja loppua
+    int64_t timeout = k_uptime_get() + 2 * (int64_t)steps * repeat * BENCH_STEP_DURATION_MS + 1000;
+    do {
+        k_msleep(BENCH_STEP_DURATION_MS);
+    } while ((atomic_get(&group->programs_pending) != 0 || k_msgq_num_used_get(&uart_line_msgq) != 0 ||
+              atomic_get(&uart_line_queue.head) != atomic_get(&uart_line_queue.tail)) &&
+             k_uptime_get() < timeout);
+    k_msleep(BENCH_STEP_DURATION_MS);  // Viimeinen vaihe sammuu ajastimessa
 
-            // Tulosta yksittäisen tehtävän aika
-            printk("Yellow task duration: %u us\n", duration_us);
+    struct metrics snapshot;
+    k_spinlock_key_t key = k_spin_lock(&metrics_lock);
+    snapshot = metrics;
+    k_spin_unlock(&metrics_lock, key);
 
-            // Ilmoita dispatcherille, että tehtävä on suoritettu
-            k_sem_give(&sequence_sem);
+    const struct latency_histogram *dwell = &snapshot.dwell_error;
+    printk("BENCH,run,steps=%u,repeat=%u,edges=%u,allocs=%u,"
+           "dispatch_us=%u,first_edge_us=%u,dwell_err_avg_us=%u,dwell_err_max_us=%u,dwell_err_p99_us=%u\n",
+           steps, repeat, dwell->count, snapshot.program_allocs, snapshot.line_to_dispatch.max, snapshot.dispatch_to_edge.max,
+           dwell->count ? (uint32_t)(dwell->sum / dwell->count) : 0, dwell->max, histogram_p99(dwell));
+}
+
+// Ohjelmat ovat kiinteissä sloteissa, joten muistin käyttö on käännösaikainen
+// vakio. Varaukset lasketaan ajossa (allocs), ja kaiutus on pois päältä,
+// jotta tulosrivit eivät sekoitu kaiutettuihin sekvensseihin.
+static void bench_main(void) {
+    atomic_val_t echo = atomic_set(&uart_echo_mode, ECHO_OFF);
 
-            k_free(item);
+    printk("BENCH,memory,slot_bytes=%u,group_bytes=%u,groups=%u\n",
+           (uint32_t)sizeof(struct sequence_program), (uint32_t)sizeof(struct signal_group), SIGNAL_GROUPS);
+
+    for (size_t i = 0; i < ARRAY_SIZE(bench_parse_steps); i++) {
+        for (size_t r = 0; r < ARRAY_SIZE(bench_repeats); r++) {
+            bench_parse(bench_parse_steps[i], bench_repeats[r]);
+        }
+    }
+    // Pitkät ohjelmat vain kerran: 10000 askelta kestää jo 50 s
+    for (size_t i = 0; i < ARRAY_SIZE(bench_run_steps); i++) {
+        bench_run(bench_run_steps[i], 1);
+        if (bench_run_steps[i] <= BENCH_LINE_STEPS) {
+            bench_run(bench_run_steps[i], 10);
         }
     }
+
+    metrics_reset();
+    atomic_set(&uart_echo_mode, echo);
+    printk("BENCH,done\n");
 }
+#endif /* CONFIG_TRAFFIC_SIGNALS_BENCHMARK */
 
 int main(void) {
-    int ret = init_uart();
+    int ret;
+
+#ifdef CONFIG_TIMING_FUNCTIONS
+    // Tarkka jaksolaskuri jäljitykseen ja mittauksiin
+    timing_init();
+    timing_start();
+#endif
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+    ret = init_gpio();
     if (ret != 0) {
-        printk("UART initialization failed!\n");
+        LOG_ERR("GPIO initialization failed!");
         return ret;
     }
+#endif
 
-    ret = init_gpio();
+    ret = signal_groups_init();
+    if (ret != 0) {
+        return ret;
+    }
+    metrics_reset();
+    signal_event_listen(signal_event_print);
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_NETCORE
+    // Jatketaan tallennettua aikataulua heti, valot eivät odota sarjaporttia
+    k_timer_init(&executor_timer, executor_timer_expiry, NULL);
+    ret = signal_detectors_init();
+    if (ret != 0) {
+        return ret;
+    }
+    ret = coord_pps_init();
+    if (ret != 0) {
+        LOG_ERR("1PPS input setup failed: %d", ret);
+        return ret;
+    }
+#ifdef CONFIG_TRAFFIC_SIGNALS_FAULT_MONITOR
+    // Valot toimivat ilman vahtikoiraakin, joten virhe ei estä käynnistystä
+    ret = fault_monitor_init();
+    if (ret != 0) {
+        LOG_ERR("Watchdog setup failed: %d", ret);
+    }
+#endif
+    ret = schedule_storage_init();
+    if (ret != 0) {
+        LOG_WRN("Schedule storage unavailable (%d)", ret);
+    }
+    // Testiajo ei jatka tallennettua aikataulua, jotta tulokset eivät sekoitu siihen
+    if (!IS_ENABLED(CONFIG_TRAFFIC_SIGNALS_BENCHMARK)) {
+        schedule_restore();
+    }
+#endif
+
+#ifndef CONFIG_TRAFFIC_SIGNALS_INTAKE_REMOTE
+    // UART-keskeytys voi heti ajaa ohituskomennon suorittajassa, joten
+    // vastaanotto käynnistetään vasta, kun ryhmät ja suorittaja ovat valmiit
+    ret = init_uart();
     if (ret != 0) {
-        printk("GPIO initialization failed!\n");
+        LOG_ERR("UART initialization failed!");
         return ret;
     }
+#endif
 
     // Odota, että kaikki alustuu
     k_msleep(100);
 
-    printk("Started serial read example\n");
+    set_log_level(DEFAULT_LOG_LEVEL);
+    LOG_INF("Started serial read example");
+
+#if defined(CONFIG_TRAFFIC_SIGNALS_NETCORE) || defined(CONFIG_TRAFFIC_SIGNALS_INTAKE_REMOTE)
+    ret = intake_ipc_init();
+    if (ret != 0) {
+        LOG_ERR("IPC initialization failed!");
+        return ret;
+    }
+#endif
 
-    // Alusta condition variablet ja muteksit
-    k_condvar_init(&red_condvar);
-    k_condvar_init(&yellow_condvar);
-    k_condvar_init(&green_condvar);
-    k_mutex_init(&led_mutex);
-    k_mutex_init(&light_mutex); // Uusi muteksi valojen hallintaan
-    k_mutex_init(&total_duration_mutex);
-    k_sem_init(&sequence_sem, 0, UINT_MAX);
+#ifndef CONFIG_TRAFFIC_SIGNALS_INTAKE_REMOTE
+    // Alusta rivijono
+    line_queue_init(&uart_line_queue);
 
     // Luo säikeet tehtäville
-    k_thread_create(&uart_receive_thread_data, uart_receive_stack, STACK_SIZE,
+    k_thread_create(&uart_receive_thread_data, uart_receive_stack, K_THREAD_STACK_SIZEOF(uart_receive_stack),
                     uart_receive_task, NULL, NULL, NULL,
-                    PRIORITY, 0, K_NO_WAIT);
+                    UART_RECEIVE_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&uart_receive_thread_data, "uart_receive");
 
-    k_thread_create(&dispatcher_thread_data, dispatcher_stack, STACK_SIZE,
+    k_thread_create(&dispatcher_thread_data, dispatcher_stack, K_THREAD_STACK_SIZEOF(dispatcher_stack),
                     dispatcher_task, NULL, NULL, NULL,
-                    PRIORITY, 0, K_NO_WAIT);
-
-    k_thread_create(&red_task_thread_data, red_task_stack, STACK_SIZE,
-                    red_light_task, NULL, NULL, NULL,
-                    PRIORITY, 0, K_NO_WAIT);
-
-    k_thread_create(&green_task_thread_data, green_task_stack, STACK_SIZE,
-                    green_light_task, NULL, NULL, NULL,
-                    PRIORITY, 0, K_NO_WAIT);
+                    DISPATCHER_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&dispatcher_thread_data, "dispatcher");
+#endif
 
-    k_thread_create(&yellow_task_thread_data, yellow_task_stack, STACK_SIZE,
-                    yellow_light_task, NULL, NULL, NULL,
-                    PRIORITY, 0, K_NO_WAIT);
+#ifdef CONFIG_TRAFFIC_SIGNALS_BENCHMARK
+    bench_main();
+#endif
 
     return 0;
 }
@@ -0,0 +1,228 @@
+/*
+ * Protokollan puhtaat osat: sekvenssijäsennin, binäärikehysten purku,
+ * LEB128-luvut ja viivehistogrammin 99. persentiili. Sovelluksen main.c
+ * käännetään tähän sellaisenaan, jotta sen staattiset funktiot ovat
+ * testattavissa. Sovelluksen main nimetään uudelleen, koska ztestillä on oma.
+ */
+#include <zephyr/ztest.h>
+
+#define main traffic_signals_main
+#include "main.c"
+#undef main
+
+static struct sequence_program test_program;
+
+static void *protocol_setup(void) {
+    zassert_ok(init_gpio());
+    zassert_ok(signal_groups_init());
+    zassert_ok(signal_detectors_init());
+    return NULL;
+}
+
+// Käännetään teksti ryhmän 1 ohjelmaksi
+static enum seq_parse_error compile(const char *text, uint16_t *column) {
+    program_init(&test_program);
+    test_program.group = find_signal_group(1);
+    zassert_not_null(test_program.group);
+    return compile_sequence(text, &test_program, column, false);
+}
+
+static enum seq_parse_error decode(const uint8_t *payload, size_t len, uint16_t *column, bool *more) {
+    program_init(&test_program);
+    test_program.group = find_signal_group(1);
+    zassert_not_null(test_program.group);
+    return decode_frame(payload, len, &test_program, column, false, more);
+}
+
+ZTEST(protocol, test_parse_sequence) {
+    uint16_t column;
+
+    zassert_equal(compile("R,1000,G,500,T,2", &column), SEQ_ERR_NONE);
+    zassert_equal(test_program.step_count, 2);
+    zassert_equal(test_program.steps[0].color, 'R');
+    zassert_equal(test_program.steps[0].duration, 1000);
+    zassert_equal(test_program.steps[0].max_duration, 1000);
+    zassert_equal(test_program.steps[1].color, 'G');
+    zassert_equal(test_program.steps[1].duration, 500);
+    zassert_equal(test_program.repeat_times, 2);
+}
+
+ZTEST(protocol, test_parse_detector_step) {
+    uint16_t column;
+
+    zassert_equal(compile("G,5000/20000@1,R,1000", &column), SEQ_ERR_NONE);
+    zassert_equal(test_program.step_count, 2);
+    zassert_equal(test_program.steps[0].duration, 5000);
+    zassert_equal(test_program.steps[0].max_duration, 20000);
+    zassert_equal(test_program.steps[0].detector, 1);
+    zassert_equal(test_program.steps[1].detector, 0);
+    zassert_equal(test_program.repeat_times, 1);
+}
+
+ZTEST(protocol, test_parse_cycle) {
+    uint16_t column;
+
+    zassert_equal(compile("C,60000,12000,G,30000,R,27000", &column), SEQ_ERR_NONE);
+    zassert_equal(test_program.cycle_ms, 60000);
+    zassert_equal(test_program.offset_ms, 12000);
+    zassert_equal(test_program.step_count, 2);
+}
+
+// Jäsennin etenee merkki kerrallaan, joten syötteen saa katkaista mistä tahansa
+ZTEST(protocol, test_parse_split_input) {
+    struct seq_parser parser;
+    struct seq_token token;
+
+    program_init(&test_program);
+    test_program.group = find_signal_group(1);
+    seq_parser_init(&parser);
+    zassert_equal(program_feed(&parser, &test_program, "R,10", false, &token), SEQ_ERR_NONE);
+    zassert_equal(test_program.step_count, 0);
+    zassert_equal(program_feed(&parser, &test_program, "00,G,5", false, &token), SEQ_ERR_NONE);
+    zassert_equal(seq_parser_finish(&parser, &token), SEQ_TOKEN_STEP);
+    zassert_equal(program_add_token(&test_program, &token), SEQ_ERR_NONE);
+    zassert_equal(test_program.step_count, 2);
+    zassert_equal(test_program.steps[0].duration, 1000);
+    zassert_equal(test_program.steps[1].duration, 5);
+}
+
+ZTEST(protocol, test_parse_errors) {
+    static const struct {
+        const char *text;
+        enum seq_parse_error error;
+        uint16_t column;
+    } cases[] = {
+        {"R,x", SEQ_ERR_EXPECTED_NUMBER, 3},
+        {"R1000", SEQ_ERR_EXPECTED_COMMA, 2},
+        {"R,1000,G", SEQ_ERR_EXPECTED_COMMA, 9},
+        {"R,1000;", SEQ_ERR_EXPECTED_SEPARATOR, 7},
+        {"1,R", SEQ_ERR_EXPECTED_COLOR, 1},
+        {"T,0", SEQ_ERR_REPEAT_RANGE, 1},
+        {"R,1000,T,2,G,5", SEQ_ERR_TRAILING_INPUT, 12},
+        {"Q,1000", SEQ_ERR_UNKNOWN_COLOR, 1},
+        {"G,500/100@1", SEQ_ERR_MAX_RANGE, 1},
+        {"G,500/1000", SEQ_ERR_EXPECTED_DETECTOR, 10},
+        {"C,1000,0,R,600,G,600", SEQ_ERR_CYCLE_RANGE, 16},
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+        uint16_t column;
+        enum seq_parse_error err = compile(cases[i].text, &column);
+
+        zassert_equal(err, cases[i].error, "\"%s\": error %d", cases[i].text, err);
+        zassert_equal(column, cases[i].column, "\"%s\": column %u", cases[i].text, column);
+    }
+
+    uint16_t column;
+    zassert_equal(compile("R,4294967296", &column), SEQ_ERR_NUMBER_RANGE);
+}
+
+ZTEST(protocol, test_frame_decode) {
+    // R 1000, G 500, T 2
+    static const uint8_t payload[] = {0x00, 'R', 0xE8, 0x07, 'G', 0xF4, 0x03, 'T', 0x02};
+    uint16_t column;
+    bool more;
+
+    zassert_equal(decode(payload, sizeof(payload), &column, &more), SEQ_ERR_NONE);
+    zassert_false(more);
+    zassert_equal(test_program.step_count, 2);
+    zassert_equal(test_program.steps[0].color, 'R');
+    zassert_equal(test_program.steps[0].duration, 1000);
+    zassert_equal(test_program.steps[1].color, 'G');
+    zassert_equal(test_program.steps[1].duration, 500);
+    zassert_equal(test_program.repeat_times, 2);
+
+    static const uint8_t continued[] = {FRAME_FLAG_MORE, 'R', 0x05};
+    zassert_equal(decode(continued, sizeof(continued), &column, &more), SEQ_ERR_NONE);
+    zassert_true(more);
+    zassert_equal(test_program.step_count, 1);
+}
+
+ZTEST(protocol, test_frame_detector_step) {
+    // /20000 @1 G 5000 eli G,5000/20000@1
+    static const uint8_t payload[] = {0x00, '/', 0xA0, 0x9C, 0x01, '@', 0x01, 'G', 0x88, 0x27};
+    uint16_t column;
+    bool more;
+
+    zassert_equal(decode(payload, sizeof(payload), &column, &more), SEQ_ERR_NONE);
+    zassert_equal(test_program.step_count, 1);
+    zassert_equal(test_program.steps[0].color, 'G');
+    zassert_equal(test_program.steps[0].duration, 5000);
+    zassert_equal(test_program.steps[0].max_duration, 20000);
+    zassert_equal(test_program.steps[0].detector, 1);
+}
+
+ZTEST(protocol, test_frame_errors) {
+    static const struct {
+        uint8_t payload[8];
+        size_t len;
+        enum seq_parse_error error;
+        uint16_t column;
+    } cases[] = {
+        {{0x00, 'R', 0xE8}, 3, SEQ_ERR_EXPECTED_NUMBER, 1},
+        {{0x00, 'R', 0xFF, 0xFF, 0xFF, 0xFF, 0x1F}, 7, SEQ_ERR_NUMBER_RANGE, 1},
+        {{0x00, 'T', 0x02, 'R', 0x05}, 5, SEQ_ERR_TRAILING_INPUT, 3},
+        {{0x00, 'T', 0x00}, 3, SEQ_ERR_REPEAT_RANGE, 1},
+        {{0x00, 'Q', 0x05}, 3, SEQ_ERR_UNKNOWN_COLOR, 1},
+        {{0x00, '/', 0x0A}, 3, SEQ_ERR_EXPECTED_COLOR, 1},
+        {{0x00, '@', 0x01, 'G', 0x05}, 5, SEQ_ERR_EXPECTED_DETECTOR, 1},
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(cases); i++) {
+        uint16_t column;
+        bool more;
+        enum seq_parse_error err = decode(cases[i].payload, cases[i].len, &column, &more);
+
+        zassert_equal(err, cases[i].error, "case %u: error %d", (unsigned int)i, err);
+        zassert_equal(column, cases[i].column, "case %u: column %u", (unsigned int)i, column);
+    }
+}
+
+ZTEST(protocol, test_varint) {
+    uint32_t value;
+
+    static const uint8_t one[] = {0x05};
+    zassert_equal(frame_read_varint(one, sizeof(one), &value), 1);
+    zassert_equal(value, 5);
+
+    static const uint8_t two[] = {0xE8, 0x07};
+    zassert_equal(frame_read_varint(two, sizeof(two), &value), 2);
+    zassert_equal(value, 1000);
+
+    static const uint8_t max[] = {0xFF, 0xFF, 0xFF, 0xFF, 0x0F};
+    zassert_equal(frame_read_varint(max, sizeof(max), &value), 5);
+    zassert_equal(value, UINT32_MAX);
+
+    static const uint8_t overflow[] = {0xFF, 0xFF, 0xFF, 0xFF, 0x10};
+    zassert_equal(frame_read_varint(overflow, sizeof(overflow), &value), -1);
+
+    static const uint8_t truncated[] = {0x80};
+    zassert_equal(frame_read_varint(truncated, sizeof(truncated), &value), 0);
+
+    static const uint8_t too_long[] = {0x80, 0x80, 0x80, 0x80, 0x80};
+    zassert_equal(frame_read_varint(too_long, sizeof(too_long), &value), -1);
+}
+
+ZTEST(protocol, test_histogram_p99) {
+    struct latency_histogram h = {.min = UINT32_MAX};
+
+    zassert_equal(histogram_p99(&h), 0);
+
+    // 99 arvoa ämpärissä [8, 16) ja yksi poikkeama: yläraja on ämpärin reuna
+    for (int i = 0; i < 99; i++) {
+        metrics_record(&h, 10);
+    }
+    metrics_record(&h, 5000);
+    zassert_equal(h.count, 100);
+    zassert_equal(h.max, 5000);
+    zassert_equal(histogram_p99(&h), 15);
+
+    // Yläraja ei ylitä suurinta havaintoa
+    struct latency_histogram same = {.min = UINT32_MAX};
+    for (int i = 0; i < 10; i++) {
+        metrics_record(&same, 100);
+    }
+    zassert_equal(histogram_p99(&same), 100);
+}
+
+ZTEST_SUITE(protocol, NULL, protocol_setup, NULL, NULL, NULL);